@@ -0,0 +1,113 @@
+#include "cascade_stats.h"
+
+namespace tless {
+    void CascadeStats::reset() {
+        *this = CascadeStats();
+    }
+
+    CascadeStats &CascadeStats::operator+=(const CascadeStats &rhs) {
+        candidates += rhs.candidates;
+
+        for (int i = 0; i <= TESTS; ++i) {
+            passed[i] += rhs.passed[i];
+        }
+
+        for (int i = 0; i < TESTS; ++i) {
+            evaluated[i] += rhs.evaluated[i];
+            points[i] += rhs.points[i];
+        }
+
+        return *this;
+    }
+
+    cv::FileStorage &operator<<(cv::FileStorage &fs, const CascadeStats &stats) {
+        const char *names[CascadeStats::TESTS + 1] = {"I", "II", "III", "IV", "V"};
+
+        fs << "{";
+        fs << "candidates" << static_cast<double>(stats.candidates);
+        fs << "passed" << "{";
+        for (int i = 0; i <= CascadeStats::TESTS; ++i) {
+            fs << names[i] << static_cast<double>(stats.passed[i]);
+        }
+        fs << "}";
+        fs << "avgPoints" << "{";
+        for (int i = 0; i < CascadeStats::TESTS; ++i) {
+            fs << names[i + 1] << (stats.evaluated[i] > 0 ? stats.points[i] / static_cast<double>(stats.evaluated[i]) : 0);
+        }
+        fs << "}";
+        fs << "}";
+
+        return fs;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const CascadeStats &stats) {
+        const char *names[CascadeStats::TESTS + 1] = {"I", "II", "III", "IV", "V"};
+
+        os << "  |_ Candidates: " << stats.candidates << ", passed:";
+        for (int i = 0; i <= CascadeStats::TESTS; ++i) {
+            os << " " << names[i] << ": " << stats.passed[i] << (i < CascadeStats::TESTS ? "," : "");
+        }
+
+        os << std::endl << "  |_ Avg. points evaluated:";
+        for (int i = 0; i < CascadeStats::TESTS; ++i) {
+            double avg = stats.evaluated[i] > 0 ? stats.points[i] / static_cast<double>(stats.evaluated[i]) : 0;
+            os << " " << names[i + 1] << ": " << avg << " (" << stats.evaluated[i] << "x)" << (i + 1 < CascadeStats::TESTS ? "," : "");
+        }
+
+        return os;
+    }
+
+    cv::FileStorage &operator<<(cv::FileStorage &fs, const LevelStats &stats) {
+        fs << "{";
+        fs << "scale" << stats.scale;
+        fs << "windows" << static_cast<int>(stats.windows);
+        fs << "verifiedWindows" << static_cast<int>(stats.verifiedWindows);
+        fs << "avgCandidates" << (stats.verifiedWindows > 0 ? stats.candidates / static_cast<double>(stats.verifiedWindows) : 0);
+        fs << "matches" << static_cast<int>(stats.matches);
+        fs << "cascade" << stats.cascade;
+        fs << "}";
+
+        return fs;
+    }
+
+    CascadeStats FrameStats::cascade() const {
+        CascadeStats total;
+
+        for (auto &level : levels) {
+            total += level.cascade;
+        }
+
+        return total;
+    }
+
+    cv::FileStorage &operator<<(cv::FileStorage &fs, const FrameStats &stats) {
+        fs << "{";
+        fs << "matchesBeforeNMS" << static_cast<int>(stats.matchesBeforeNMS);
+        fs << "matchesAfterNMS" << static_cast<int>(stats.matchesAfterNMS);
+        fs << "levels" << "[";
+        for (auto &level : stats.levels) {
+            fs << level;
+        }
+        fs << "]";
+        fs << "}";
+
+        return fs;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const FrameStats &stats) {
+        size_t windows = 0, verifiedWindows = 0, candidates = 0;
+
+        for (auto &level : stats.levels) {
+            windows += level.windows;
+            verifiedWindows += level.verifiedWindows;
+            candidates += level.candidates;
+        }
+
+        os << "  |_ Windows: " << windows << ", after hashing: " << verifiedWindows << ", avg. candidates: "
+           << (verifiedWindows > 0 ? candidates / static_cast<double>(verifiedWindows) : 0) << std::endl;
+        os << stats.cascade() << std::endl;
+        os << "  |_ Matches before NMS: " << stats.matchesBeforeNMS << ", after NMS: " << stats.matchesAfterNMS;
+
+        return os;
+    }
+}
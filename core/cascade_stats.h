@@ -0,0 +1,69 @@
+#ifndef VSB_SEMESTRAL_PROJECT_CASCADE_STATS_H
+#define VSB_SEMESTRAL_PROJECT_CASCADE_STATS_H
+
+#include <ostream>
+#include <vector>
+#include <opencv2/core/persistence.hpp>
+
+namespace tless {
+    /**
+     * @brief Counters of template matching cascade, used to see how much work each test of the cascade does.
+     */
+    struct CascadeStats {
+    public:
+        static const int TESTS = 4; //!< Number of feature point tests (II - V)
+        unsigned long long candidates = 0; //!< Number of (window, candidate) pairs that entered the cascade
+        unsigned long long passed[TESTS + 1] = {}; //!< Number of candidates that passed each test (I - V)
+        unsigned long long evaluated[TESTS] = {}; //!< Number of candidates each test (II - V) was computed for
+        unsigned long long points[TESTS] = {}; //!< Number of feature points evaluated in each test (II - V)
+
+        /**
+         * @brief Sets all counters to zero.
+         */
+        void reset();
+
+        CascadeStats &operator+=(const CascadeStats &rhs);
+        friend cv::FileStorage &operator<<(cv::FileStorage &fs, const CascadeStats &stats);
+        friend std::ostream &operator<<(std::ostream &os, const CascadeStats &stats);
+    };
+
+    /**
+     * @brief Detection funnel of one level of scene pyramid.
+     */
+    struct LevelStats {
+    public:
+        float scale = 1.0f; //!< Scale of the pyramid level
+        size_t windows = 0; //!< Windows produced by objectness detection (left near matches of previous level with criteria.matchGuidedLevels)
+        size_t verifiedWindows = 0; //!< Windows with candidates left after hashing verification
+        size_t candidates = 0; //!< Sum of candidates across all verified windows
+        size_t matches = 0; //!< Matches found in this level
+        CascadeStats cascade; //!< Matching cascade counters
+
+        LevelStats() = default;
+        explicit LevelStats(float scale) : scale(scale) {}
+
+        friend cv::FileStorage &operator<<(cv::FileStorage &fs, const LevelStats &stats);
+    };
+
+    /**
+     * @brief Detection funnel of one scene frame, from objectness detection to non-maxima suppression.
+     */
+    struct FrameStats {
+    public:
+        std::vector<LevelStats> levels; //!< Funnel of each processed pyramid level
+        size_t matchesBeforeNMS = 0; //!< Matches of all levels before non-maxima suppression
+        size_t matchesAfterNMS = 0; //!< Matches retained after non-maxima suppression
+
+        /**
+         * @brief Sums matching cascade counters of all levels.
+         *
+         * @return Cascade counters of the whole frame
+         */
+        CascadeStats cascade() const;
+
+        friend cv::FileStorage &operator<<(cv::FileStorage &fs, const FrameStats &stats);
+        friend std::ostream &operator<<(std::ostream &os, const FrameStats &stats);
+    };
+}
+
+#endif
@@ -13,6 +13,10 @@ namespace tless {
         os << "  |_ minMagnitude: " << crit.minMagnitude << std::endl;
         os << "  |_ maxDepthDiff: " << crit.maxDepthDiff << std::endl;
         os << "  |_ depthDeviation: " << crit.depthDeviation << std::endl;
+        os << "  |_ firstTierTables: " << crit.firstTierTables << std::endl;
+        os << "  |_ firstTierRecall: " << crit.firstTierRecall << std::endl;
+        os << "  |_ greedyTableSelection: " << crit.greedyTableSelection << std::endl;
+        os << "  |_ sortFeaturePoints: " << crit.sortFeaturePoints << std::endl;
         os << "  |_ minVotes: " << crit.minVotes << std::endl;
         os << "  |_ windowStep: " << crit.windowStep << std::endl;
         os << "  |_ patchOffset: " << crit.patchOffset << std::endl;
@@ -25,6 +29,13 @@ namespace tless {
         os << "  |_ pyrLvlsUp: " << crit.pyrLvlsUp << std::endl;
         os << "  |_ pyrLvlsDown: " << crit.pyrLvlsDown << std::endl;
         os << "  |_ maxHueDiff: " << crit.maxHueDiff << std::endl;
+        os << "  |_ multiProbeMargin: " << crit.multiProbeMargin << std::endl;
+        os << "  |_ denseHashKeys: " << crit.denseHashKeys << std::endl;
+        os << "  |_ linearMatching: " << crit.linearMatching << std::endl;
+        os << "  |_ templateMajor: " << crit.templateMajor << std::endl;
+        os << "  |_ earlyAccept: " << crit.earlyAccept << std::endl;
+        os << "  |_ matchGuidedLevels: " << crit.matchGuidedLevels << std::endl;
+        os << "  |_ matchGuidedRadius: " << crit.matchGuidedRadius << std::endl;
         os << "Fine pose: " << std::endl;
         os << "  |_ generations: " << crit.generations << std::endl;
         os << "  |_ popSize: " << crit.popSize << std::endl;
@@ -37,6 +48,7 @@ namespace tless {
         os << "  |_ maxDepth: " << crit.info.maxDepth << std::endl;
         os << "  |_ smallestDiameter: " << crit.info.smallestDiameter << std::endl;
         os << "  |_ maxId: " << crit.info.maxId << std::endl;
+        os << "  |_ firstTierMinVotes: " << crit.info.firstTierMinVotes << std::endl;
         os << "  |_ minEdgels: " << crit.info.minEdgels << std::endl;
         os << "  |_ depthScaleFactor: " << crit.info.depthScaleFactor << std::endl;
         os << "  |_ smallestTemplate: " << crit.info.smallestTemplate.width << "x" << crit.info.smallestTemplate.height
@@ -54,17 +66,19 @@ namespace tless {
         node["objectnessDiameterThreshold"] >> crit->objectnessDiameterThreshold;
 
         // Load unsigned int params
-        int tablesCount, featurePointsCount, depthBinCount, tablesTrainingMultiplier, maxCandidates;
+        int tablesCount, featurePointsCount, depthBinCount, tablesTrainingMultiplier, maxCandidates, firstTierTables;
         node["tablesCount"] >> tablesCount;
         node["maxCandidates"] >> maxCandidates;
         node["depthBinCount"] >> depthBinCount;
         node["tablesTrainingMultiplier"] >> tablesTrainingMultiplier;
         node["featurePointsCount"] >> featurePointsCount;
+        node["firstTierTables"] >> firstTierTables;
         crit->tablesCount = static_cast<uint>(tablesCount);
         crit->maxCandidates = static_cast<uint>(maxCandidates);
         crit->depthBinCount = static_cast<uint>(depthBinCount);
         crit->tablesTrainingMultiplier = static_cast<uint>(tablesTrainingMultiplier);
         crit->featurePointsCount = static_cast<uint>(featurePointsCount);
+        crit->firstTierTables = static_cast<uint>(firstTierTables);
 
         cv::FileNode info = node["info"];
         info["depthScaleFactor"] >> crit->info.depthScaleFactor;
@@ -75,6 +89,7 @@ namespace tless {
         info["maxDepth"] >> crit->info.maxDepth;
         info["smallestDiameter"] >> crit->info.smallestDiameter;
         info["maxId"] >> crit->info.maxId;
+        info["firstTierMinVotes"] >> crit->info.firstTierMinVotes;
     }
 
     cv::FileStorage &operator<<(cv::FileStorage &fs, const ClassifierCriteria &crit) {
@@ -85,6 +100,7 @@ namespace tless {
         fs << "depthBinCount" << static_cast<int>(crit.depthBinCount);
         fs << "tablesTrainingMultiplier" << static_cast<int>(crit.tablesTrainingMultiplier);
         fs << "featurePointsCount" << static_cast<int>(crit.featurePointsCount);
+        fs << "firstTierTables" << static_cast<int>(crit.firstTierTables);
         fs << "minMagnitude" << crit.minMagnitude;
         fs << "maxDepthDiff" << crit.maxDepthDiff;
         fs << "objectnessDiameterThreshold" << crit.objectnessDiameterThreshold;
@@ -97,6 +113,7 @@ namespace tless {
         fs << "maxDepth" << crit.info.maxDepth;
         fs << "smallestDiameter" << crit.info.smallestDiameter;
         fs << "maxId" << crit.info.maxId;
+        fs << "firstTierMinVotes" << crit.info.firstTierMinVotes;
         fs << "}";
         fs << "}";
 
@@ -23,6 +23,10 @@ namespace tless {
         ushort maxDepthDiff = 100; //!< When computing surface normals, contribution of pixel is ignored if the depth difference with central pixel is above this threshold
         float objectnessDiameterThreshold = 0.3f; //!< Minimal threshold of sobel operator when computing depth edgels. (objectnessDiameterThreshold * objectDiameter * info.depthScaleFactor)
         float depthDeviation = .85f; //!< sqrt(depthScaleFactor)
+        uint firstTierTables = 0; //!< Number of tables in the first tier of hashing cascade, windows failing the first tier skip the rest of tables (0 = disabled)
+        float firstTierRecall = 0.95f; //!< Fraction of training windows (templates shifted by up to half of windowStep) that have to pass the first tier, used to learn info.firstTierMinVotes
+        bool greedyTableSelection = false; //!< Pick tables greedily by information their keys carry about templates not covered by already picked tables, instead of by size
+        bool sortFeaturePoints = false; //!< Reorder feature points of each template by rarity of their features, so the matching tests reject candidates sooner
 
         // Detect Params
         float pyrScaleFactor = 1.25f; //!< Scale factor for building scene image pyramid
@@ -36,6 +40,13 @@ namespace tless {
         float overlapFactor = 0.5f; //!< Permitted factor of which two templates can overlap
         float depthK = 0.5f; //!< Constant used in depth test in template matching phase
         int maxHueDiff = 5; //!< Constant used in hue color matching, abs difference of 2 hue values should be lower than this for the test to pass
+        float multiProbeMargin = 0; //!< Relative depths closer to a bin boundary than this fraction of bin width also vote for the adjacent bin (0 = disabled)
+        bool denseHashKeys = false; //!< Compute hash keys of each table once per pyramid level on the whole window grid, instead of per window (not used with multi-probe)
+        bool linearMatching = false; //!< Evaluate tests II and III using linearized response maps for all windows at once (per template), instead of per window lookups
+        bool templateMajor = false; //!< Evaluate candidates grouped by templates (each template against all it's windows), instead of window by window
+        bool earlyAccept = false; //!< Stop each matching test once the threshold is reached (pass/fail only, match scores are then computed from lower bounds)
+        bool matchGuidedLevels = false; //!< In upscaled levels (above original scale) search only objectness windows near matches of previous level (recall vs. full search not measured)
+        int matchGuidedRadius = 1; //!< Neighbourhood (in window steps) around projected matches searched in upscaled levels
 
         // Fine pose
         int generations = 50; //!< Number of generations to run for each population
@@ -54,6 +65,7 @@ namespace tless {
             cv::Size smallestTemplate{500, 500}; //!< Size of the largest template found across all templates
             cv::Size largestArea{0, 0}; //!< Size of the largest area (largest width and largest height) found across all templates
             int maxId = 0; //!< Holds the max ID value of a template in database
+            int firstTierMinVotes = 0; //!< Votes the best template of a window needs in the first tier of hashing cascade (learned in training)
         } info;
 
         friend void operator>>(const cv::FileNode &node, cv::Ptr<ClassifierCriteria> crit);
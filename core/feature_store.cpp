@@ -0,0 +1,60 @@
+#include "feature_store.h"
+#include <cstdlib>
+#include <new>
+
+namespace tless {
+    FeatureStore::~FeatureStore() {
+        clear();
+    }
+
+    void FeatureStore::clear() {
+        std::free(records);
+        records = nullptr;
+        templates.clear();
+    }
+
+    void FeatureStore::build(std::vector<Template> &templates, uint featurePointsCount) {
+        CV_Assert(featurePointsCount <= MAX_FEATURE_POINTS);
+        clear();
+
+        // Allocate records aligned to cache lines
+        void *ptr = nullptr;
+        if (!templates.empty() && posix_memalign(&ptr, alignof(TemplateFeatures), templates.size() * sizeof(TemplateFeatures)) != 0) {
+            throw std::bad_alloc();
+        }
+
+        records = static_cast<TemplateFeatures *>(ptr);
+
+        for (size_t i = 0; i < templates.size(); ++i) {
+            Template &t = templates[i];
+            TemplateFeatures *f = new (records + i) TemplateFeatures();
+            this->templates.push_back(&t);
+
+            // Removed templates keep their handle with an empty record
+            if (t.removed()) {
+                continue;
+            }
+
+            assert(t.stablePoints.size() >= featurePointsCount);
+            assert(t.edgePoints.size() >= featurePointsCount);
+            assert(t.features.normals.size() >= featurePointsCount);
+
+            for (uint j = 0; j < featurePointsCount; ++j) {
+                f->normals[j] = t.features.normals[j];
+                f->gradients[j] = t.features.gradients[j];
+                f->hue[j] = t.features.hue[j];
+                f->depths[j] = t.features.depths[j];
+                f->stableX[j] = static_cast<short>(t.stablePoints[j].x);
+                f->stableY[j] = static_cast<short>(t.stablePoints[j].y);
+                f->edgeX[j] = static_cast<short>(t.edgePoints[j].x);
+                f->edgeY[j] = static_cast<short>(t.edgePoints[j].y);
+            }
+
+            f->avgDepth = t.features.avgDepth;
+            f->width = static_cast<short>(t.objBB.width);
+            f->height = static_cast<short>(t.objBB.height);
+            f->diameter = t.diameter;
+            f->objArea = t.objArea;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef VSB_SEMESTRAL_PROJECT_FEATURE_STORE_H
+#define VSB_SEMESTRAL_PROJECT_FEATURE_STORE_H
+
+#include <opencv2/core/hal/interface.h>
+#include <vector>
+#include "template.h"
+
+namespace tless {
+    static const int MAX_FEATURE_POINTS = 128; //!< Max value of criteria.featurePointsCount supported by the feature store
+
+    /**
+     * @brief Matching features of one template packed into fixed-size arrays, each record is one contiguous block of memory.
+     *
+     * Feature points are stored as offsets relative to the template window (int16) split to x and y arrays.
+     */
+    struct alignas(64) TemplateFeatures {
+        uchar normals[MAX_FEATURE_POINTS]; //!< quantized surface normals at stable points
+        uchar gradients[MAX_FEATURE_POINTS]; //!< quantized oriented gradients at edge points
+        uchar hue[MAX_FEATURE_POINTS]; //!< hue value from HSV color space at stable points
+        ushort depths[MAX_FEATURE_POINTS]; //!< depth value at stable points
+        short stableX[MAX_FEATURE_POINTS], stableY[MAX_FEATURE_POINTS]; //!< Stable feature points
+        short edgeX[MAX_FEATURE_POINTS], edgeY[MAX_FEATURE_POINTS]; //!< Edge feature points
+        ushort avgDepth = 0; //!< average depth across all feature points
+        short width = 0, height = 0; //!< Size of object bounding box
+        float diameter = 0; //!< Object diameter
+        float objArea = 0; //!< Area object covers relative to it's window
+    };
+
+    /**
+     * @brief Contiguous storage of template matching features, used in hashing and matching instead of Template objects.
+     *
+     * Templates are identified by handles - indices of the template in the array the store was built from. Heavy
+     * template data (images, camera, ...) are accessed only through tpl() when it's really needed (e.g. creating matches).
+     */
+    class FeatureStore {
+    private:
+        TemplateFeatures *records = nullptr;
+        std::vector<Template *> templates;
+
+    public:
+        FeatureStore() = default;
+        FeatureStore(const FeatureStore &) = delete;
+        FeatureStore &operator=(const FeatureStore &) = delete;
+        ~FeatureStore();
+
+        /**
+         * @brief Packs features of each template into the store, handle of each template is it's index in templates array.
+         *
+         * Removed templates (Template::removed()) get an empty record, they're never referenced by hash tables.
+         *
+         * @param[in] templates          Array of templates with extracted features (templates have to outlive the store)
+         * @param[in] featurePointsCount Number of feature points of each template (criteria.featurePointsCount)
+         */
+        void build(std::vector<Template> &templates, uint featurePointsCount);
+
+        /**
+         * @brief Releases all records.
+         */
+        void clear();
+
+        size_t size() const {
+            return templates.size();
+        }
+
+        const TemplateFeatures &operator[](uint handle) const {
+            return records[handle];
+        }
+
+        /**
+         * @brief Returns template identified by given handle.
+         *
+         * @param[in] handle Template handle (index of template the store was built from)
+         * @return           Pointer to the template
+         */
+        Template *tpl(uint handle) const {
+            return templates[handle];
+        }
+    };
+}
+
+#endif
@@ -1,14 +1,99 @@
 #include "hash_table.h"
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 
 namespace tless {
-    void HashTable::pushUnique(const HashKey &key, Template &t) {
-        // Check if key exists, if not initialize it
-        auto& vec = templates[key.hash()];
+    void HashTable::pushUnique(const HashKey &key, uint handle) {
+        assert(handle <= std::numeric_limits<ushort>::max());
+        pending.push_back(static_cast<uint>(key.hash() << 16) | handle);
+    }
+
+    void HashTable::freeze() {
+        // Merge already frozen entries with the builder
+        for (size_t key = 0; !offsets.empty() && key < HASH_TABLE_KEYS; ++key) {
+            for (uint j = offsets[key]; j < offsets[key + 1]; ++j) {
+                pending.push_back(static_cast<uint>(key << 16) | ids[j]);
+            }
+        }
+
+        // Sort entries by key and handle and remove duplicates
+        std::sort(pending.begin(), pending.end());
+        pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+        // Count templates at each key and compute offsets using prefix sum
+        offsets.assign(HASH_TABLE_KEYS + 1, 0);
+        ids.resize(pending.size());
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            offsets[(pending[i] >> 16) + 1]++;
+            ids[i] = static_cast<ushort>(pending[i] & 0xFFFF);
+        }
+
+        for (size_t key = 0; key < HASH_TABLE_KEYS; ++key) {
+            offsets[key + 1] += offsets[key];
+        }
+
+        size = ids.size();
+        std::vector<uint>().swap(pending);
+        buildBitsets();
+    }
+
+    void HashTable::buildBitsets() {
+        denseSlots.clear();
+        bits.clear();
+        bitsetWords = ids.empty() ? 0 : *std::max_element(ids.begin(), ids.end()) / 64u + 1;
+
+        for (size_t key = 0; key < HASH_TABLE_KEYS; ++key) {
+            const uint count = offsets[key + 1] - offsets[key];
+
+            // Incrementing counters is cheaper for small buckets
+            if (count <= DENSE_BUCKET_RATIO * bitsetWords) {
+                continue;
+            }
+
+            // Slots are allocated only for tables with dense buckets, so sparse lookups stay a single check
+            if (denseSlots.empty()) {
+                denseSlots.resize(HASH_TABLE_KEYS, 0);
+            }
+
+            denseSlots[key] = static_cast<ushort>(bits.size() / bitsetWords + 1);
+            bits.resize(bits.size() + bitsetWords, 0);
+            uint64 *bitset = &bits[bits.size() - bitsetWords];
+
+            for (uint j = offsets[key]; j < offsets[key + 1]; ++j) {
+                bitset[ids[j] / 64] |= uint64(1) << (ids[j] % 64);
+            }
+        }
+    }
+
+    void HashTable::remap(const std::vector<int> &handles) {
+        if (offsets.empty()) {
+            return;
+        }
+
+        // Compact remaining handles of each key in place, new offsets never exceed the old ones
+        uint kept = 0, first = offsets[0];
+        for (size_t key = 0; key < HASH_TABLE_KEYS; ++key) {
+            const uint last = offsets[key + 1];
+            offsets[key] = kept;
 
-        if (std::find_if(vec.begin(), vec.end(), [&t](const Template *tt) { return t == *tt; }) == vec.end()) {
-            vec.push_back(&t);
-            size++;
+            for (uint j = first; j < last; ++j) {
+                assert(ids[j] < handles.size());
+
+                if (handles[ids[j]] >= 0) {
+                    assert(handles[ids[j]] <= std::numeric_limits<ushort>::max());
+                    ids[kept++] = static_cast<ushort>(handles[ids[j]]);
+                }
+            }
+
+            first = last;
         }
+
+        offsets[HASH_TABLE_KEYS] = kept;
+        ids.resize(kept);
+        size = ids.size();
+        buildBitsets();
     }
 
     std::ostream &operator<<(std::ostream &os, const HashTable &table) {
@@ -22,14 +107,14 @@ namespace tless {
         }
 
         os << "Table contents: (d1, d2, n1, n2, n3)" << std::endl;
-        for (int j = 0; j < table.templates.size(); ++j) {
-            if (table.templates[j].empty()) {
+        for (size_t j = 0; j < HASH_TABLE_KEYS; ++j) {
+            if (table[j].empty()) {
                 continue;
             }
 
             os << "  |_ " << HashKey::unhash(j) << " : (";
-            for (const auto &item : table.templates[j]) {
-                os << item->id << ", ";
+            for (const auto &item : table[j]) {
+                os << item << ", ";
             }
             os << ")" << std::endl;
         }
@@ -37,12 +122,15 @@ namespace tless {
         return os;
     }
 
-    HashTable HashTable::load(cv::FileNode &node, std::vector<Template> &templates) {
+    HashTable HashTable::load(cv::FileNode &node, const std::vector<Template> &templates) {
         HashTable table;
 
-        int size;
-        node["size"] >> size;
-        table.size = static_cast<size_t>(size);
+        // Map template ids to handles
+        std::unordered_map<int, uint> handles;
+        for (uint i = 0; i < templates.size(); ++i) {
+            handles[templates[i].id] = i;
+        }
+
         node["binRanges"] >> table.binRanges;
 
         cv::FileNode tripletNode = node["triplet"];
@@ -66,18 +154,19 @@ namespace tless {
             cv::FileNode templatesNode = row["templates"];
 
             for (auto &&tplId : templatesNode) {
-                table.templates[key.hash()].reserve(templatesNode.size());
                 tplId >> id;
 
-                // Loop through existing templates and save pointers to matching ids
-                for (auto &t : templates) {
-                    if (id == t.id) {
-                        table.templates[key.hash()].push_back(&t);
-                    }
+                // Save handle of template with matching id
+                auto handle = handles.find(id);
+                if (handle != handles.end()) {
+                    table.pushUnique(key, handle->second);
                 }
             }
         }
 
+        // Convert loaded handles to compact layout (this also computes table size)
+        table.freeze();
+
         return table;
     }
 
@@ -97,21 +186,21 @@ namespace tless {
         return !(*this < rhs);
     }
 
-    cv::FileStorage &operator<<(cv::FileStorage &fs, const HashTable &table) {
+    void HashTable::save(cv::FileStorage &fs, const std::vector<Template> &templates) const {
         // Save triplet
         fs << "{";
-        fs << "size" << static_cast<int>(table.size);
-        fs << "binRanges" << table.binRanges;
+        fs << "size" << static_cast<int>(size);
+        fs << "binRanges" << binRanges;
         fs << "triplet" << "{";
-        fs << "p1" << table.triplet.p1;
-        fs << "c" << table.triplet.c;
-        fs << "p2" << table.triplet.p2;
+        fs << "p1" << triplet.p1;
+        fs << "c" << triplet.c;
+        fs << "p2" << triplet.p2;
         fs << "}";
 
         // Save Templates
         fs << "data" << "[";
-        for (int i = 0; i < table.templates.size(); ++i) {
-            if (table.templates[i].empty()) {
+        for (size_t i = 0; i < HASH_TABLE_KEYS; ++i) {
+            if ((*this)[i].empty()) {
                 continue;
             }
 
@@ -128,15 +217,13 @@ namespace tless {
 
             // Save template IDS
             fs << "templates" << "[";
-            for (auto &t : table.templates[i]) {
-                fs << t->id;
+            for (auto &handle : (*this)[i]) {
+                fs << templates[handle].id;
             }
             fs << "]";
             fs << "}";
         }
         fs << "]";
         fs << "}";
-
-        return fs;
     }
 }
\ No newline at end of file
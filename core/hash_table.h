@@ -9,18 +9,51 @@
 #include <utility>
 
 namespace tless {
+    static const size_t HASH_TABLE_KEYS = 18944; //!< Number of different hashed keys (see HashKey::hash())
+    static const size_t DENSE_BUCKET_RATIO = 4; //!< Bucket is stored also as a bitset, if it holds more templates than DENSE_BUCKET_RATIO * bitset words
+
     /**
      * @brief Represents 1 hash table identified by unique triplet.
      *
      * Each hash table is then filled with set of valid candidates, based
      * on the custom hash key, that's formed on template quantized values.
+     *
+     * Templates are first pushed to a temporary builder (pairs of key and handle) and the table is then frozen
+     * to a compressed sparse row layout - offsets of each key into one contiguous array of 16-bit template handles.
+     * Dense buckets are in addition stored as bitsets over template handles, so voting can add them using bit-sliced counters.
      */
     class HashTable {
+    private:
+        std::vector<uint> pending; //!< Builder of (key << 16 | handle) entries, released on freeze()
+        std::vector<uint> offsets; //!< Start of each key in ids array, offsets[key + 1] is the end of the key
+        std::vector<ushort> ids; //!< Template handles (indices into FeatureStore) of all keys stored one after another
+        std::vector<ushort> denseSlots; //!< Index of bitset of each key in bits + 1, 0 for sparse keys (empty if there are no dense buckets)
+        std::vector<uint64> bits; //!< Bitsets of dense buckets stored one after another (bitsetWords each)
+        uint bitsetWords = 0; //!< Number of 64-bit words of each bitset
+
+        /**
+         * @brief Stores buckets, for which adding a bitset is cheaper than incrementing counter of each template, also as bitsets.
+         */
+        void buildBitsets();
+
     public:
+        /**
+         * @brief Contiguous range of template handles stored at one hash key.
+         */
+        struct Bucket {
+            const ushort *first = nullptr, *last = nullptr;
+            const uint64 *bits = nullptr; //!< Bitset of the bucket (dense buckets only)
+            uint words = 0; //!< Number of 64-bit words in bitset
+
+            const ushort *begin() const { return first; }
+            const ushort *end() const { return last; }
+            size_t size() const { return static_cast<size_t>(last - first); }
+            bool empty() const { return first == last; }
+        };
+
         size_t size = 0;  //!< Size of hash table (in terms of number of templates)
         Triplet triplet;
         std::vector<cv::Range> binRanges;
-        std::vector<std::vector<Template*>> templates{18944};
 
         HashTable() = default;
         HashTable(Triplet triplet) : triplet(triplet) {}
@@ -29,33 +62,72 @@ namespace tless {
          * @brief Loads hash table from trained classifier.yml file.
          *
          * @param[in] node      File node identifying hash table in classifier.yml file
-         * @param[in] templates Templates from dataset, these are used to assign correct pointers for each hash key
+         * @param[in] templates Templates from dataset, these are used to assign correct handles for each hash key
          *                      (comparison is done based on matching ids)
-         * @return              Parsed hash table, with all assigned template pointers
+         * @return              Parsed hash table, with all assigned template handles
+         */
+        static HashTable load(cv::FileNode &node, const std::vector<Template> &templates);
+
+        /**
+         * @brief Saves hash table to classifier.yml file, template handles are persisted as template ids.
+         *
+         * @param[out] fs        Opened file storage to save hash table to
+         * @param[in]  templates Templates the hash table was trained on, handles are indices into this array
          */
-        static HashTable load(cv::FileNode &node, std::vector<Template> &templates);
+        void save(cv::FileStorage &fs, const std::vector<Template> &templates) const;
 
         /**
          * @brief Use when pushing new templates to hash table.
          *
-         * This function makes sure that when you push new template to the hash table at specific key, it either
-         * initializes that key and pushes the template or checks, if the template is not already present at given key
-         * (checks for uniques), in that case no templates are pushed. It also increases the size counter, in case new
-         * template is pushed to the table so to retain validity for the size of the table, it's crucial to only use
-         * this function when putting new objects to hash table.
+         * Templates are pushed to the builder and become visible after the table is frozen. Duplicate templates
+         * at the same key are removed on freeze(), which also updates the size of the table, so it's crucial to only
+         * use this function when putting new objects to hash table.
          *
-         * @param[in] key  HashKey identifying place where to push new template t
-         * @param[in] t    Template to push to hash table at specified key
-         * @return         True/false whether template was pushed to the table or not
+         * @param[in] key    HashKey identifying place where to push new template
+         * @param[in] handle Handle of the template to push to hash table at specified key (has to fit into 16 bits)
          */
-        void pushUnique(const HashKey &key, Template &t);
+        void pushUnique(const HashKey &key, uint handle);
+
+        /**
+         * @brief Converts templates pushed since last freeze to compressed sparse row layout and releases the builder.
+         */
+        void freeze();
+
+        /**
+         * @brief Reassigns template handles of a frozen table, templates mapped to negative handles are removed.
+         *
+         * @param[in] handles New handle for each current handle (order of handles has to be preserved), -1 to remove the template
+         */
+        void remap(const std::vector<int> &handles);
+
+        /**
+         * @brief Returns template handles stored at given hashed key (empty bucket for tables, that were not frozen yet).
+         *
+         * @param[in] key Hashed key (HashKey::hash())
+         * @return        Range of template handles
+         */
+        Bucket operator[](size_t key) const {
+            if (offsets.empty()) {
+                return Bucket();
+            }
+
+            Bucket bucket;
+            bucket.first = ids.data() + offsets[key];
+            bucket.last = ids.data() + offsets[key + 1];
+
+            if (!denseSlots.empty() && denseSlots[key] != 0) {
+                bucket.bits = bits.data() + (denseSlots[key] - 1) * bitsetWords;
+                bucket.words = bitsetWords;
+            }
+
+            return bucket;
+        }
 
         bool operator<(const HashTable &rhs) const;
         bool operator>(const HashTable &rhs) const;
         bool operator<=(const HashTable &rhs) const;
         bool operator>=(const HashTable &rhs) const;
 
-        friend cv::FileStorage &operator<<(cv::FileStorage &fs, const HashTable &crit);
         friend std::ostream &operator<<(std::ostream &os, const HashTable &table);
     };
 }
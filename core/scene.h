@@ -15,6 +15,8 @@ namespace tless {
         cv::Mat srcRGB, srcGray, srcHue, srcDepth, srcDepthEdgels; //!< Source scene in different
         cv::Mat srcGradients, srcNormals, srcNormals3D; //!< Matrix of quantized features
         cv::Mat spreadGradients, spreadNormals; //!< Matrix of quantized features
+        cv::Mat spreadMinDepth, spreadMaxDepth, spreadHue; //!< Depth extremes and hue bins in the patch around each pixel
+        std::vector<cv::Mat> linearGradients, linearNormals; //!< Linearized response maps of spread features (one per orientation)
 
         ScenePyramid(float scale = 1.0f) : scale(scale) {}
     };
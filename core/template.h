@@ -45,15 +45,17 @@ namespace tless {
         cv::Rect objBB; //!< Object bounding box
         Camera camera; //!< Camera parameters
         float objArea = 0; //!< Area object covers relative to it's window
-        int votes = 0;
         ushort minDepth = std::numeric_limits<unsigned short>::max(), maxDepth = 0; //!< Minimum and maximum depth of the object in this template
 
-#ifdef VIZ_HASHING
-        std::vector<Triplet> triplets;
-#endif
-
         Template() = default;
 
+        /**
+         * @brief Removed templates are kept as empty placeholders (objId -1), so handles of other templates don't change.
+         */
+        bool removed() const {
+            return objId < 0;
+        }
+
         bool operator==(const Template &rhs) const;
         bool operator!=(const Template &rhs) const;
         friend void operator>>(const cv::FileNode &node, Template &t);
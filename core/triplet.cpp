@@ -49,21 +49,22 @@ namespace tless {
             angle < minAngle // angle check
         );
 
+        // Convert to absolute coordinates (window-space)
+        c = cellPosition(c, grid, window);
+        p1 = cellPosition(p1, grid, window);
+        p2 = cellPosition(p2, grid, window);
+
+        return {c, p1, p2};
+    }
+
+    cv::Point Triplet::cellPosition(cv::Point cell, cv::Size grid, cv::Size window) {
         // Generate absolute offsets and steps
         auto stepX = window.width / static_cast<float>(grid.width);
         auto stepY = window.height / static_cast<float>(grid.height);
         auto offsetX = stepX * 0.5f;
         auto offsetY = stepY * 0.5f;
 
-        // Convert to absolute coordinates (window-space)
-        c.x = static_cast<int>(stepX * c.x + offsetX);
-        c.y = static_cast<int>(stepY * c.y + offsetY);
-        p1.x = static_cast<int>(stepX * p1.x + offsetX);
-        p1.y = static_cast<int>(stepY * p1.y + offsetY);
-        p2.x = static_cast<int>(stepX * p2.x + offsetX);
-        p2.y = static_cast<int>(stepY * p2.y + offsetY);
-
-        return {c, p1, p2};
+        return {static_cast<int>(stepX * cell.x + offsetX), static_cast<int>(stepY * cell.y + offsetY)};
     }
 
     std::ostream &operator<<(std::ostream &os, const Triplet &triplet) {
@@ -42,6 +42,16 @@ namespace tless {
          */
         static Triplet create(cv::Size grid, cv::Size window);
 
+        /**
+         * @brief Converts relative grid cell coordinates (grid-space) to absolute coordinates (window-space).
+         *
+         * @param[in] cell   Cell coordinates in the grid
+         * @param[in] grid   Relative grid size
+         * @param[in] window Size of the window the grid is placed over
+         * @return           Absolute coordinates of the cell center
+         */
+        static cv::Point cellPosition(cv::Point cell, cv::Size grid, cv::Size window);
+
         Triplet() = default;
         Triplet(cv::Point &c, cv::Point &p1, cv::Point &p2) : c(c), p1(p1), p2(p2) {}
 
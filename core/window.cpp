@@ -29,7 +29,7 @@ namespace tless {
         os << "[" << w.width << "," << w.height << "]" << " at" << "(" << w.x << "," << w.y << ")" << " candidates["
            << w.candidates.size() << "](";
         for (const auto &c : w.candidates) {
-            os << c->id << ", ";
+            os << c << ", ";
         }
         os << ")";
         return os;
@@ -13,7 +13,7 @@ namespace tless {
         int x = 0, y = 0;
         int width = 0, height = 0;
         int edgels = 0; //!< Number of edgels this window contain (detected in objectness detection)
-        std::vector<Template *> candidates;
+        std::vector<uint> candidates; //!< Handles of template candidates (indices into FeatureStore)
 #ifdef VIZ_HASHING
         std::vector<int> votes;
         std::vector<std::vector<Triplet>> triplets;
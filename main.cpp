@@ -2,6 +2,7 @@
 #include <opencv2/opencv.hpp>
 #include "objdetect/classifier.h"
 #include "processing/processing.h"
+#include "utils/benchmark.h"
 #include "utils/converter.h"
 #include "utils/evaluator.h"
 #include "utils/timer.h"
@@ -11,7 +12,7 @@ static const int SENSOR_KINECT = 1;
 static const int SENSOR_CURRENT = SENSOR_KINECT;
 static const int RUNS = 5;
 
-int main() {
+int main(int argc, char **argv) {
     // Dataset pairs (sceneId, templates)
     std::vector<std::pair<int, std::vector<int>>> data = {
         {1, {2, 25, 29, 30}},
@@ -56,6 +57,35 @@ int main() {
     std::string resultsPath = "data/results/" + currDate + "/%s/%02d/";
     std::string modelsPath = "data/models/";
 
+    // Benchmark detection stages on one scene image instead of evaluation (--benchmark [sceneId] [index])
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        const int sceneId = argc > 2 ? std::atoi(argv[2]) : 1;
+        const int index = argc > 3 ? std::atoi(argv[3]) : 0;
+        auto scene = std::find_if(data.begin(), data.end(), [sceneId](const std::pair<int, std::vector<int>> &pair) {
+            return pair.first == sceneId;
+        });
+
+        if (sceneId < 1 || scene == data.end()) {
+            std::cerr << "Unknown scene: " << sceneId << std::endl;
+            return 1;
+        }
+
+        // Train classifier on objects of the scene
+        tless::Classifier classifier(criteria);
+        classifier.setModelsFolder(modelsPath);
+        classifier.train(templatesPath, scene->second);
+
+        // Run all benchmarks
+        const uint tables = criteria->tablesCount;
+        tless::Benchmark benchmark(classifier);
+        benchmark.normalsQuantization(scenesPath, sceneId, index);
+        benchmark.hashingTables(scenesPath, sceneId, index, {tables / 4, tables / 2, 3 * tables / 4, tables});
+        benchmark.matchingOrder(scenesPath, sceneId, index);
+        benchmark.threadScaling(scenesPath, sceneId, index);
+
+        return 0;
+    }
+
     // Init classifier
     tless::Evaluator eval(scenesPath, 0.3f);
 
@@ -1,4 +1,5 @@
 #include "classifier.h"
+#include <set>
 #include <boost/filesystem.hpp>
 #include "../utils/timer.h"
 #include "../utils/visualizer.h"
@@ -13,8 +14,12 @@ namespace tless {
         std::cout << "Training... " << std::endl;
         std::cout << "  |_ templates -> ";
 
+        this->store.clear();
         this->templates.clear();
         this->tables.clear();
+        this->freeHandles.clear();
+        this->objIds.clear();
+        this->objMinEdgels.clear();
 
         for (auto &id : indices) {
             std::string path = cv::format((tplsFolder + "%02d/").c_str(), id);
@@ -25,14 +30,21 @@ namespace tless {
 
             // Save templates for later hash table generation
             this->templates.insert(this->templates.end(), objTpls.begin(), objTpls.end());
+            this->objMinEdgels.push_back(parser.objMinEdgels());
             std::cout << id << ", ";
 
             objTpls.clear();
         }
 
+        // Reorder feature points so matching tests can terminate sooner
+        if (criteria->sortFeaturePoints) {
+            matcher.sortFeaturePoints(this->templates);
+        }
+
         // Train hash tables
         std::cout << std::endl << "  |_ hash tables -> ";
         hasher.train(this->templates, this->tables);
+        store.build(this->templates, criteria->featurePointsCount);
         std::cout << tables.size() << " hash tables generated" << std::endl;
         std::cout << "DONE!, training took: " << tTraining.elapsed() << " s" << std::endl << std::endl;
 
@@ -45,6 +57,160 @@ namespace tless {
         assert(!this->templates.empty());
     }
 
+    void Classifier::updateInfo() {
+        // Reset info computed from templates, minEdgels is kept if not known for any object (e.g. loaded older classifier)
+        auto &info = criteria->info;
+        const int minEdgels = info.minEdgels;
+        const int firstTierMinVotes = info.firstTierMinVotes;
+        const float depthScaleFactor = info.depthScaleFactor;
+        info = decltype(criteria->info)();
+        info.depthScaleFactor = depthScaleFactor;
+        info.firstTierMinVotes = firstTierMinVotes;
+
+        int maxId = 0;
+        for (auto &t : this->templates) {
+            if (t.removed()) {
+                continue;
+            }
+
+            parser.parseInfo(t);
+            maxId = std::max(maxId, t.id);
+        }
+
+        // Use the same convention as Parser::parseObject()
+        info.maxId = maxId - 1;
+
+        for (auto &edgels : this->objMinEdgels) {
+            if (edgels > 0 && edgels < info.minEdgels) {
+                info.minEdgels = edgels;
+            }
+        }
+
+        if (info.minEdgels == std::numeric_limits<int>::max()) {
+            info.minEdgels = minEdgels;
+        }
+    }
+
+    void Classifier::addObjects(const std::string &tplsFolder, const std::vector<int> &indices) {
+        assert(!this->tables.empty());
+
+        Timer tAdding;
+        std::vector<Template> objTpls, newTpls;
+        std::cout << "Adding objects... " << std::endl;
+        std::cout << "  |_ templates -> ";
+
+        // New templates have to get ids that are not used yet (e.g. after load)
+        for (auto &t : this->templates) {
+            Parser::reserveIds(t.id);
+        }
+
+        for (auto &id : indices) {
+            // Skip already present objects
+            if (std::find(this->objIds.begin(), this->objIds.end(), id) != this->objIds.end()) {
+                continue;
+            }
+
+            std::string path = cv::format((tplsFolder + "%02d/").c_str(), id);
+
+            // Parse each object by one and extract features for it
+            parser.parseObject(path, objTpls);
+            matcher.train(objTpls);
+
+            newTpls.insert(newTpls.end(), objTpls.begin(), objTpls.end());
+            this->objIds.push_back(id);
+            this->objMinEdgels.push_back(parser.objMinEdgels());
+            std::cout << id << ", ";
+
+            objTpls.clear();
+        }
+
+        if (newTpls.empty()) {
+            std::cout << std::endl << "DONE!, no new objects" << std::endl << std::endl;
+            return;
+        }
+
+        // New templates reuse handles of removed templates first (lowest first), the rest is appended
+        std::sort(this->freeHandles.rbegin(), this->freeHandles.rend());
+        std::vector<uint> handles;
+
+        for (auto &t : newTpls) {
+            if (!this->freeHandles.empty()) {
+                handles.push_back(this->freeHandles.back());
+                this->templates[this->freeHandles.back()] = std::move(t);
+                this->freeHandles.pop_back();
+            } else {
+                handles.push_back(static_cast<uint>(this->templates.size()));
+                this->templates.push_back(std::move(t));
+            }
+        }
+
+        // Reorder feature points so matching tests can terminate sooner (rarity is computed across all templates)
+        if (criteria->sortFeaturePoints) {
+            matcher.sortFeaturePoints(this->templates);
+        }
+
+        // Insert new templates to existing hash tables
+        std::cout << std::endl << "  |_ hash tables -> ";
+        hasher.insert(this->templates, handles, this->tables);
+        updateInfo();
+
+        if (criteria->firstTierTables > 0) {
+            hasher.learnFirstTier(this->templates, this->tables);
+        }
+
+        // Templates could be reallocated and features reordered, rebuild feature store
+        store.build(this->templates, criteria->featurePointsCount);
+        std::cout << handles.size() << " templates inserted" << std::endl;
+        std::cout << "DONE!, adding took: " << tAdding.elapsed() << " s" << std::endl << std::endl;
+    }
+
+    void Classifier::removeObjects(const std::vector<int> &indices) {
+        std::cout << "Removing objects... " << std::endl;
+
+        // Keep handles of remaining templates, -1 for removed ones
+        std::vector<int> handles(this->templates.size());
+        size_t remaining = 0;
+
+        for (size_t i = 0; i < this->templates.size(); ++i) {
+            Template &t = this->templates[i];
+            const bool removed = t.removed() || std::find(indices.begin(), indices.end(), t.objId) != indices.end();
+            handles[i] = removed ? -1 : static_cast<int>(i);
+
+            // Replace removed template with an empty placeholder and make its handle free for new templates
+            if (removed && !t.removed()) {
+                t = Template();
+                t.objId = -1;
+                this->freeHandles.push_back(static_cast<uint>(i));
+            }
+
+            remaining += !removed;
+        }
+
+        // Remove handles from hash tables
+        for (auto &table : this->tables) {
+            table.remap(handles);
+        }
+
+        // Remove obj ids
+        for (size_t i = this->objIds.size(); i-- > 0;) {
+            if (std::find(indices.begin(), indices.end(), this->objIds[i]) != indices.end()) {
+                this->objIds.erase(this->objIds.begin() + i);
+                this->objMinEdgels.erase(this->objMinEdgels.begin() + i);
+            }
+        }
+
+        // Update criteria info from remaining templates
+        updateInfo();
+        if (criteria->firstTierTables > 0) {
+            hasher.learnFirstTier(this->templates, this->tables);
+        }
+
+        // Rebuild feature store to release records of removed templates
+        store.build(this->templates, criteria->featurePointsCount);
+        std::cout << "  |_ templates -> " << remaining << " remaining" << std::endl;
+        std::cout << "DONE!" << std::endl << std::endl;
+    }
+
     void Classifier::save(const std::string &trainedFolder, const std::string &classifierFileName,
                           const std::string &tplsFileFormat) {
         // Create directories if they don't exist
@@ -52,35 +218,27 @@ namespace tless {
 
         cv::FileStorage fs;
         const std::string classifierPath = trainedFolder + classifierFileName;
-        int objId = -1;
 
         std::cout << "Saving results... " << std::endl;
         assert(!this->templates.empty());
 
-        for (auto &tpl: this->templates) {
-            // Create new file for each new object
-            if (objId < 0 || objId != tpl.objId) {
-                if (fs.isOpened()) {
-                    fs << "]";
-                    fs.release();
-                }
-
-                // Save obj id as current one
-                objId = tpl.objId;
-
-                // Open new file
-                std::string tplPath = cv::format((trainedFolder + tplsFileFormat).c_str(), objId);
-                fs.open(tplPath, cv::FileStorage::WRITE);
-                fs << "templates" << "[";
+        // Create new file for each object (templates of added objects can be placed at handles of removed ones)
+        for (auto &objId : this->objIds) {
+            std::string tplPath = cv::format((trainedFolder + tplsFileFormat).c_str(), objId);
+            fs.open(tplPath, cv::FileStorage::WRITE);
+            fs << "templates" << "[";
 
-                std::cout << "  |_ " << objId << " -> " << tplPath << std::endl;
+            for (auto &tpl: this->templates) {
+                if (tpl.objId == objId) {
+                    fs << tpl;
+                }
             }
 
-            fs << tpl;
+            fs << "]";
+            fs.release();
+            std::cout << "  |_ " << objId << " -> " << tplPath << std::endl;
         }
 
-        fs.release();
-
         // Save classifier info and hashTables
         fs.open(classifierPath, cv::FileStorage::WRITE);
 
@@ -90,13 +248,14 @@ namespace tless {
 
         // Save info about parsed objects
         fs << "objIds" << this->objIds;
+        fs << "objMinEdgels" << this->objMinEdgels;
 
         // Persist hashTables
         assert(!this->tables.empty());
 
         fs << "tables" << "[";
         for (auto &table : this->tables) {
-            fs << table;
+            table.save(fs, this->templates);
         }
         fs << "]";
 
@@ -109,14 +268,18 @@ namespace tless {
         Timer tLoading;
         std::cout << "Loading trained templates... " << std::endl;
 
+        store.clear();
         templates.clear();
         tables.clear();
+        freeHandles.clear();
         std::string criteriaPath = trainedFolder + classifierFileName;
 
         // Load criteria
         cv::FileStorage fsc(criteriaPath, cv::FileStorage::READ);
         fsc["criteria"] >> criteria;
         fsc["objIds"] >> this->objIds;
+        fsc["objMinEdgels"] >> this->objMinEdgels;
+        this->objMinEdgels.resize(this->objIds.size(), 0);
         std::cout << "  |_ loaded criteria -> " << criteriaPath << std::endl;
         std::cout << "  |_ templates -> ";
 
@@ -142,6 +305,10 @@ namespace tless {
             this->tables.emplace_back(HashTable::load(table, templates));
         }
 
+        // Pack template features and precompute hue bins for loaded criteria
+        store.build(templates, criteria->featurePointsCount);
+        matcher.initHueBins();
+
         fsc.release();
         std::cout << std::endl << "  |_ loaded hash tables (" << tables.size() << ")" << std::endl;
         std::cout << "DONE!, took: " << tLoading.elapsed() << " s" << std::endl << std::endl;
@@ -150,12 +317,21 @@ namespace tless {
     }
 
     void Classifier::detect(const std::string &scenesFolder, std::vector<int> sceneIndices, const std::string &resultsFolder,
-                            int startScene, int endScene, const std::string &resultsFileFormat) {
+                            int startScene, int endScene, const std::string &resultsFileFormat, const std::vector<int> &objects) {
         assert(criteria->info.smallestTemplate.area() > 0);
         assert(criteria->info.minEdgels > 0);
 
+        // Restrict hash tables to active objects
+        std::vector<HashTable> restricted;
+        if (!objects.empty()) {
+            activeTables(objects, restricted);
+        }
+
+        std::vector<HashTable> &detectTables = objects.empty() ? tables : restricted;
+
         std::vector<std::vector<double>> timers;
         std::vector<std::vector<Match>> results;
+        std::vector<FrameStats> funnels;
         std::vector<Window> windows;
         std::vector<Match> matches;
 
@@ -177,6 +353,7 @@ namespace tless {
             for (int i = startScene; i < endScene; ++i) {
                 // Reset timers
                 ttObjectness = ttVerification = ttMatching = 0;
+                FrameStats funnel;
                 tTotal.reset();
 
                 // Load scene
@@ -186,13 +363,25 @@ namespace tless {
                 ttSceneLoading = tSceneLoading.elapsed();
 
                 // Verification for current level of image pyramid
+                size_t levelMatches = 0; // Index of the first match found in previous level
                 for (int l = 0; l <= pyrLevels; ++l) {
+                    funnel.levels.emplace_back(scene.pyramid[l].scale);
+                    LevelStats &level = funnel.levels.back();
+
                     /// Objectness detection
                     Timer tObjectness;
                     objectness(scene.pyramid[l].srcDepth, scene.pyramid[l].srcDepthEdgels, windows, criteria->info.smallestTemplate,
                                criteria->windowStep, criteria->info.minDepth, criteria->info.maxDepth, minDepthMag, minEdgels);
+
+                    // Upscaled levels search only near matches of previous level
+                    if (criteria->matchGuidedLevels && l > criteria->pyrLvlsDown) {
+                        guideWindows(matches, levelMatches, windows);
+                    }
+
                     ttObjectness += tObjectness.elapsed();
                     viz.objectness(scene.pyramid[l], windows);
+                    levelMatches = matches.size();
+                    level.windows = windows.size();
 
                     if (windows.empty()) {
                         continue;
@@ -200,21 +389,36 @@ namespace tless {
 
                     /// Verification and filtering of template candidates
                     Timer tVerification;
-                    hasher.verifyCandidates(scene.pyramid[l].srcDepth, scene.pyramid[l].srcNormals, tables, windows);
+                    hasher.verifyCandidates(scene.pyramid[l].srcDepth, scene.pyramid[l].srcNormals, detectTables, store, windows);
                     ttVerification += tVerification.elapsed();
-                    viz.windowsCandidates(scene.pyramid[l], windows);
+                    viz.windowsCandidates(scene.pyramid[l], store, windows);
+
+                    if (windows.empty()) {
+                        continue;
+                    }
+
+                    // Count windows and candidates entering matching
+                    level.verifiedWindows = windows.size();
+                    for (auto &window : windows) {
+                        level.candidates += window.candidates.size();
+                    }
 
                     /// Match templates
                     Timer tMatching;
-                    matcher.match(scene.pyramid[l], windows, matches);
+                    matcher.stats.reset();
+                    matcher.match(scene.pyramid[l], store, windows, matches);
                     ttMatching += tMatching.elapsed();
+                    level.cascade = matcher.stats;
+                    level.matches = matches.size() - levelMatches;
                     windows.clear();
                 }
 
                 // Apply non-maxima suppression
                 viz.preNonMaxima(scene.pyramid[criteria->pyrLvlsDown], matches, 0);
                 Timer tNMS;
+                funnel.matchesBeforeNMS = matches.size();
                 nms(matches, criteria->overlapFactor);
+                funnel.matchesAfterNMS = matches.size();
                 ttNMS = tNMS.elapsed();
 
                 // Vizualize results and clear current matches
@@ -227,6 +431,7 @@ namespace tless {
                 std::cout << "  |_ Hashing verification took: " << ttVerification << "s" << std::endl;
                 std::cout << "  |_ Template matching took: " << ttMatching << "s" << std::endl;
                 std::cout << "  |_ NMS took: " << ttNMS << "s" << std::endl;
+                std::cout << funnel << std::endl;
 
                 // Apply fine pose estimation
 #ifdef FINE_POSE
@@ -246,17 +451,58 @@ namespace tless {
 
                 // Save times each section took
                 timers.push_back({ttSceneLoading, ttObjectness, ttVerification, ttMatching, ttNMS, ttFinePose});
+                funnels.push_back(std::move(funnel));
                 results.emplace_back(std::move(matches));
             }
 
             // Save results
-            saveResults(sceneId, results, resultsFolder, resultsFileFormat, timers, startScene);
+            saveResults(sceneId, results, resultsFolder, resultsFileFormat, timers, funnels, startScene);
             results.clear();
+            timers.clear();
+            funnels.clear();
+        }
+    }
+
+    void Classifier::activeTables(const std::vector<int> &objects, std::vector<HashTable> &active) {
+        // Keep handles of active templates, remove the rest
+        std::vector<int> handles(templates.size());
+        for (size_t i = 0; i < templates.size(); ++i) {
+            bool isActive = std::find(objects.begin(), objects.end(), templates[i].objId) != objects.end();
+            handles[i] = isActive ? static_cast<int>(i) : -1;
+        }
+
+        active = tables;
+        for (auto &table : active) {
+            table.remap(handles);
+        }
+    }
+
+    void Classifier::guideWindows(const std::vector<Match> &matches, size_t first, std::vector<Window> &windows) {
+        const int step = criteria->windowStep;
+        const int radius = criteria->matchGuidedRadius;
+        std::set<std::pair<int, int>> cells; // Grid positions around projected matches
+
+        for (size_t i = first; i < matches.size(); ++i) {
+            // Project matched window to current level and snap it to the sliding window grid
+            const int cx = static_cast<int>(std::round(matches[i].objBB.x * criteria->pyrScaleFactor / step));
+            const int cy = static_cast<int>(std::round(matches[i].objBB.y * criteria->pyrScaleFactor / step));
+
+            for (int y = cy - radius; y <= cy + radius; ++y) {
+                for (int x = cx - radius; x <= cx + radius; ++x) {
+                    cells.emplace(x, y);
+                }
+            }
         }
+
+        // Keep only windows near projected matches
+        windows.erase(std::remove_if(windows.begin(), windows.end(), [&cells, step](const Window &window) {
+            return cells.find(std::make_pair(window.x / step, window.y / step)) == cells.end();
+        }), windows.end());
     }
 
     void Classifier::saveResults(int sceneId, const std::vector<std::vector<Match>> &results, const std::string &resultsFolder,
-                                     const std::string &resultsFileFormat, const std::vector<std::vector<double>> &timers, int startIndex) {
+                                     const std::string &resultsFileFormat, const std::vector<std::vector<double>> &timers,
+                                     const std::vector<FrameStats> &funnels, int startIndex) {
         // Crete directories
         boost::filesystem::create_directories(resultsFolder);
 
@@ -275,6 +521,7 @@ namespace tless {
             fs << "nms" << timers[i][4];
             fs << "finePose" << timers[i][5];
             fs << "}";
+            fs << "funnel" << funnels[i];
             fs << "matches" << "[";
             for (auto &match : results[i]) {
                 fs << Result(match);
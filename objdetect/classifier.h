@@ -4,6 +4,8 @@
 #include <memory>
 #include "../core/match.h"
 #include "../core/hash_table.h"
+#include "../core/feature_store.h"
+#include "../core/cascade_stats.h"
 #include "../utils/parser.h"
 #include "hasher.h"
 #include "../core/window.h"
@@ -11,24 +13,60 @@
 #include "../core/classifier_criteria.h"
 
 namespace tless {
+    class Benchmark;
+
     /**
      * @brief Main class of the whole project which handles all training and classification.
      */
     class Classifier {
     private:
+        friend class Benchmark;
+
         std::string shadersFolder = "data/shaders/";
         std::string modelsFolder = "data/models/";
         std::string modelsFileFormat = "obj_%02d.ply";
 
         cv::Ptr<ClassifierCriteria> criteria;
         std::vector<int> objIds;
+        std::vector<int> objMinEdgels; //!< Minimum edgels found in templates of each object in objIds (0 if unknown)
         std::vector<Template> templates;
+        std::vector<uint> freeHandles; //!< Handles of removed templates, reused by templates of added objects
         std::vector<HashTable> tables;
+        FeatureStore store; //!< Matching features of templates, built after templates are trained or loaded
 
         Parser parser;
         Hasher hasher;
         Matcher matcher;
 
+        /**
+         * @brief Recomputes criteria info (template sizes, depth extremes, smallest diameter, min edgels and max id) from current templates.
+         */
+        void updateInfo();
+
+        /**
+         * @brief Narrows objectness windows of upscaled pyramid level to neighbourhoods of previous level matches (criteria.matchGuidedLevels).
+         *
+         * Each match is scaled by criteria.pyrScaleFactor and snapped to the sliding window grid, only objectness windows
+         * within criteria.matchGuidedRadius grid steps are kept. Candidates are then picked by hashing as usual, so templates
+         * of any scale can match (not just the template matched in previous level).
+         *
+         * @param[in]     matches Array of matches found so far
+         * @param[in]     first   Index of the first match found in previous level
+         * @param[in,out] windows Objectness windows of current level, windows far from all matches are removed
+         */
+        void guideWindows(const std::vector<Match> &matches, size_t first, std::vector<Window> &windows);
+
+        /**
+         * @brief Creates copies of hash tables containing only templates of given objects.
+         *
+         * Template handles are kept, so the copies work with the same feature store. Buckets of copied
+         * tables are smaller, which reduces work in both hashing and matching.
+         *
+         * @param[in]  objects Ids of active objects
+         * @param[out] active  Hash tables restricted to active objects
+         */
+        void activeTables(const std::vector<int> &objects, std::vector<HashTable> &active);
+
         /**
          * @brief Saves matched results to yml file for further evaluation.
          *
@@ -36,9 +74,13 @@ namespace tless {
          * @param[in] results           Array of found matches
          * @param[in] resultsFolder     Path to results folder (created if doesn't exist)
          * @param[in] resultsFileFormat File format for the results file
+         * @param[in] timers            Times each detection stage took for each scene
+         * @param[in] funnels           Detection funnel statistics for each scene
+         * @param[in] startIndex        Index of the first scene
          */
         void saveResults(int sceneId, const std::vector<std::vector<Match>> &results, const std::string &resultsFolder,
-                         const std::string &resultsFileFormat, const std::vector<std::vector<double>> &timers, int startIndex = 0);
+                         const std::string &resultsFileFormat, const std::vector<std::vector<double>> &timers,
+                         const std::vector<FrameStats> &funnels, int startIndex = 0);
 
     public:
         explicit Classifier(cv::Ptr<ClassifierCriteria> criteria) :
@@ -51,9 +93,10 @@ namespace tless {
          * @param[in] sceneIndices      Scene indicies identifying scenes we want to run detection on
          * @param[in] resultsFolder     Folder containing all results files
          * @param[in] resultsFileFormat File format of the results file
+         * @param[in] objects           Ids of objects that can appear in scenes (subset of trained objects), all objects if empty
          */
         void detect(const std::string &scenesFolder, std::vector<int> sceneIndices, const std::string &resultsFolder, int startScene,
-                       int endScene, const std::string &resultsFileFormat = "results_%02d.yml.gz");
+                       int endScene, const std::string &resultsFileFormat = "results_%02d.yml.gz", const std::vector<int> &objects = {});
 
         /**
          * @brief Trains hastables and extract template features for objects defined in indicies parameter.
@@ -63,6 +106,29 @@ namespace tless {
          */
         void train(const std::string &tplsFolder, const std::vector<int> &indices);
 
+        /**
+         * @brief Extracts features for templates of new objects and inserts them into already trained (or loaded) hash tables.
+         *
+         * Triplets and bin ranges of existing tables are kept, handles of already present templates don't change.
+         * New templates reuse handles of removed templates first. Feature points of all templates are reordered by rarity
+         * and criteria info is recomputed. Objects that are already part of the classifier are skipped.
+         *
+         * @param[in] tplsFolder Path to templates folder containing object folders (01, 02, ...)
+         * @param[in] indices    Indicies of objects to add
+         */
+        void addObjects(const std::string &tplsFolder, const std::vector<int> &indices);
+
+        /**
+         * @brief Removes templates of given objects from the classifier and its hash tables.
+         *
+         * Handles of remaining templates don't change, removed templates are replaced by empty placeholders (Template::removed())
+         * and their handles are reused by addObjects(). Placeholders are not saved, so handles are compacted by save() and load().
+         * Criteria info and threshold of the first tier of hashing cascade are recomputed from remaining templates.
+         *
+         * @param[in] indices Indicies of objects to remove
+         */
+        void removeObjects(const std::vector<int> &indices);
+
         /**
          * @brief Save trained classifier and templates.
          *
@@ -306,7 +306,6 @@ namespace tless {
         float sumD = 0, sumU = 0, sumE = 0;
 
         // Compute Distance transform
-        cv::Mat poseT, poseEdges;
         depthEdgels(poseDepth, poseEdges, 100, 100000, 360, 255, 0);
         cv::distanceTransform(poseEdges, poseT, CV_DIST_L2, 3);
 
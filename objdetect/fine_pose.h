@@ -21,6 +21,7 @@ namespace tless {
         GLFWwindow *window;
         cv::Ptr<ClassifierCriteria> criteria;
         int maxDepthDiff = 200;
+        cv::Mat poseEdges, poseT; //!< Buffers reused across objFun() calls (edgels and their distance transform)
 
         /**
          * @brief Vizualizes current particle by rendering it's mesh at approximate pose into objBB in the scene pyramid image.
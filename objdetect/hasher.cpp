@@ -1,9 +1,14 @@
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
 #include <unordered_set>
 #include <gsl/gsl_qrng.h>
 #include "hasher.h"
 #include "../utils/timer.h"
 #include "../processing/processing.h"
 #include "../processing/computation.h"
+#include "../processing/kernels.h"
 #include "../core/classifier_criteria.h"
 
 namespace tless {
@@ -64,36 +69,201 @@ namespace tless {
         return {d1, d2, n1, n2, n3};
     }
 
-    void Hasher::initializeBinRanges(std::vector<Template> &templates, std::vector<HashTable> &tables) {
-        #pragma omp parallel for shared(templates, tables)
+    /**
+     * Quantizes relative depth and finds adjacent bin, if the depth lies within margin from the boundary of its bin.
+     *
+     * @return Number of bins written to bins (0 if depth doesn't fall into any bin)
+     */
+    static int probeDepthBins(int depth, const std::vector<cv::Range> &ranges, float margin, uchar bins[2]) {
+        for (size_t i = 0; i < ranges.size(); i++) {
+            if (depth >= ranges[i].start && depth < ranges[i].end) {
+                const auto m = static_cast<int>(margin * (ranges[i].end - ranges[i].start));
+                int count = 0;
+                bins[count++] = DEPTH_LUT[i];
+
+                if (i > 0 && depth - ranges[i].start < m) {
+                    bins[count++] = DEPTH_LUT[i - 1];
+                } else if (i + 1 < ranges.size() && ranges[i].end - 1 - depth < m) {
+                    bins[count++] = DEPTH_LUT[i + 1];
+                }
+
+                return count;
+            }
+        }
+
+        return 0;
+    }
+
+    int Hasher::probeHashKeys(const Triplet &triplet, const std::vector<cv::Range> &binRanges, const cv::Mat &depth,
+                              const cv::Mat &normals, cv::Rect window, float margin, size_t keys[4]) {
+        assert(depth.type() == CV_16UC1);
+        assert(normals.type() == CV_8UC1);
+
+        // Offset triplet points by window
+        cv::Point nP1 = triplet.p1 + window.tl();
+        cv::Point nP2 = triplet.p2 + window.tl();
+        cv::Point nC = triplet.c + window.tl();
+
+        // Get quantized normals and depths at triplet points
+        uchar n1 = normals.at<uchar>(nP1);
+        uchar n2 = normals.at<uchar>(nP2);
+        uchar n3 = normals.at<uchar>(nC);
+        auto p1D = static_cast<int>(depth.at<ushort>(nP1));
+        auto p2D = static_cast<int>(depth.at<ushort>(nP2));
+        auto cD = static_cast<int>(depth.at<ushort>(nC));
+
+        // Validate normals and depths
+        if (n1 == 0 || n2 == 0 || n3 == 0 || cD <= 0 || p1D <= 0 || p2D <= 0) {
+            return 0;
+        }
+
+        // Quantize depths including adjacent bins
+        uchar d1[2], d2[2];
+        const int c1 = probeDepthBins(p1D - cD, binRanges, margin, d1);
+        const int c2 = probeDepthBins(p2D - cD, binRanges, margin, d2);
+
+        int count = 0;
+        for (int i = 0; i < c1; ++i) {
+            for (int j = 0; j < c2; ++j) {
+                keys[count++] = HashKey(d1[i], d2[j], n1, n2, n3).hash();
+            }
+        }
+
+        return count;
+    }
+
+    void Hasher::buildGridCache(const std::vector<Template> &templates, const std::vector<uint> &handles, GridCache &cache) {
+        const cv::Size grid = criteria->tripletGrid;
+
+        // Compute positions of grid cells the same way triplets are generated
+        cache.cells.clear();
+        for (int y = 0; y < grid.height; ++y) {
+            for (int x = 0; x < grid.width; ++x) {
+                cache.cells.push_back(Triplet::cellPosition({x, y}, grid, criteria->info.largestArea));
+            }
+        }
+
+        const auto rows = static_cast<int>(handles.size());
+        const auto cols = static_cast<int>(cache.cells.size());
+        cache.gray.create(rows, cols, CV_8UC1);
+        cache.normals.create(rows, cols, CV_8UC1);
+        cache.depth.create(rows, cols, CV_16UC1);
+
+        #pragma omp parallel for shared(templates, handles, cache) firstprivate(rows, cols)
+        for (int r = 0; r < rows; ++r) {
+            assert(handles[r] < templates.size());
+            const Template &t = templates[handles[r]];
+            auto *gray = cache.gray.ptr<uchar>(r);
+            auto *normals = cache.normals.ptr<uchar>(r);
+            auto *depth = cache.depth.ptr<ushort>(r);
+
+            for (int c = 0; c < cols; ++c) {
+                cv::Point p = cache.cells[c] + t.objBB.tl();
+
+                // Points outside of template images are invalid
+                if (p.x < 0 || p.y < 0 || p.x >= t.srcDepth.cols || p.y >= t.srcDepth.rows) {
+                    gray[c] = normals[c] = 0;
+                    depth[c] = 0;
+                    continue;
+                }
+
+                // Gray check is skipped for templates without gray image
+                gray[c] = t.srcGray.empty() ? std::numeric_limits<uchar>::max() : t.srcGray.at<uchar>(p);
+                normals[c] = t.srcNormals.at<uchar>(p);
+                depth[c] = t.srcDepth.at<ushort>(p);
+            }
+        }
+    }
+
+    bool Hasher::tripletCells(const Triplet &triplet, const GridCache &cache, int cells[3]) {
+        const cv::Point points[3] = {triplet.c, triplet.p1, triplet.p2};
+
+        for (int i = 0; i < 3; ++i) {
+            auto cell = std::find(cache.cells.begin(), cache.cells.end(), points[i]);
+            if (cell == cache.cells.end()) {
+                return false;
+            }
+
+            cells[i] = static_cast<int>(cell - cache.cells.begin());
+        }
+
+        return true;
+    }
+
+    HashKey Hasher::cachedHashKey(const int cells[3], const std::vector<cv::Range> &binRanges, const GridCache &cache, int row,
+                                  uchar minGray) {
+        const auto *gray = cache.gray.ptr<uchar>(row);
+        const auto *normals = cache.normals.ptr<uchar>(row);
+        const auto *depth = cache.depth.ptr<ushort>(row);
+
+        // Check for minimal gray value (triplet is on an object)
+        if (gray[cells[0]] < minGray || gray[cells[1]] < minGray || gray[cells[2]] < minGray) {
+            return {};
+        }
+
+        // Get and validate quantized normals at triplet points
+        uchar n1 = normals[cells[1]];
+        uchar n2 = normals[cells[2]];
+        uchar n3 = normals[cells[0]];
+
+        if (n1 == 0 || n2 == 0 || n3 == 0) {
+            return {};
+        }
+
+        // Get and validate depth value at each triplet point
+        auto p1D = static_cast<int>(depth[cells[1]]);
+        auto p2D = static_cast<int>(depth[cells[2]]);
+        auto cD = static_cast<int>(depth[cells[0]]);
+
+        if (cD <= 0 || p1D <= 0 || p2D <= 0) {
+            return {};
+        }
+
+        // Initialize to invalid value, but != 0 to pass validation in bin Ranges generation
+        uchar d1 = 200, d2 = 200;
+
+        // Quantize depths
+        if (!binRanges.empty()) {
+            d1 = quantizeDepth(p1D - cD, binRanges);
+            d2 = quantizeDepth(p2D - cD, binRanges);
+        }
+
+        // Skip wrong depths
+        if (d1 == 0 || d2 == 0) {
+            return {};
+        }
+
+        return {d1, d2, n1, n2, n3};
+    }
+
+    void Hasher::initializeBinRanges(std::vector<Template> &templates, const GridCache &cache, std::vector<HashTable> &tables) {
+        assert(cache.depth.rows == static_cast<int>(templates.size()));
+
+        #pragma omp parallel for shared(templates, cache, tables)
         for (size_t i = 0; i < tables.size(); i++) {
             const int binCount = criteria->depthBinCount;
             std::vector<int> rDepths;
+            int cells[3];
 
-            for (auto &t : templates) {
-                assert(!t.srcDepth.empty());
+            // Triplets generated in training always lie at grid cells
+            if (!tripletCells(tables[i].triplet, cache, cells)) {
+                assert(false);
+                continue;
+            }
 
+            for (int t = 0; t < cache.depth.rows; ++t) {
                 // Validate triplet
-                if (validateTripletAndComputeHashKey(tables[i].triplet, {}, t.srcDepth, t.srcNormals, t.srcGray, t.objBB).empty()) {
+                if (cachedHashKey(cells, {}, cache, t).empty()) {
                     continue;
                 }
 
-                // Offset triplet points by template bounding box
-                cv::Point nP1 = tables[i].triplet.p1 + t.objBB.tl();
-                cv::Point nP2 = tables[i].triplet.p2 + t.objBB.tl();
-                cv::Point nC = tables[i].triplet.c + t.objBB.tl();
-
-                // Get depth value at each triplet point
-                auto p1D = static_cast<int>(t.srcDepth.at<ushort>(nP1));
-                auto p2D = static_cast<int>(t.srcDepth.at<ushort>(nP2));
-                auto cD = static_cast<int>(t.srcDepth.at<ushort>(nC));
-
                 // Compute relative diff
-                int diff1 = p1D - cD;
-                int diff2 = p2D - cD;
+                const auto *depth = cache.depth.ptr<ushort>(t);
+                int diff1 = static_cast<int>(depth[cells[1]]) - depth[cells[0]];
+                int diff2 = static_cast<int>(depth[cells[2]]) - depth[cells[0]];
 
                 // Ignore diffs larger than obj diameter + threshold
-                float diam = t.diameter * criteria->info.depthScaleFactor * 1.5f;
+                float diam = templates[t].diameter * criteria->info.depthScaleFactor * 1.5f;
                 if (std::abs(diff1) > diam || std::abs(diff2) > diam) {
                     continue;
                 }
@@ -144,20 +314,203 @@ namespace tless {
             tables.emplace_back(Triplet::create(criteria->tripletGrid, criteria->info.largestArea));
         }
 
+        // Read template values at triplet grid cells once for all tables
+        std::vector<uint> handles(templates.size());
+        std::iota(handles.begin(), handles.end(), 0);
+        GridCache cache;
+        buildGridCache(templates, handles, cache);
+
         // Initialize bin ranges for each table
-        initializeBinRanges(templates, tables);
+        initializeBinRanges(templates, cache, tables);
 
         // Fill hash tables with templates at quantized keys
-        #pragma omp parallel for shared(templates, tables) firstprivate(criteria)
-        for (size_t i = 0; i < tables.size(); i++) {
-            for (auto &t : templates) {
-                // Skip tables with no no defined ranges
-                if (tables[i].binRanges.empty()) {
+        fillTables(templates, handles, cache, tables);
+
+        // Pick complementary tables or only first 100 tables with the most quantized templates
+        if (criteria->greedyTableSelection) {
+            selectTables(templates.size(), tables);
+        } else {
+            std::stable_sort(tables.rbegin(), tables.rend());
+            tables.resize(criteria->tablesCount);
+        }
+
+        // Order tables, so the first tier of hashing cascade is formed by the most complementary tables and learn its threshold
+        if (criteria->firstTierTables > 0) {
+            if (!criteria->greedyTableSelection) {
+                selectTables(templates.size(), tables);
+            }
+
+            learnFirstTier(templates, tables);
+        }
+    }
+
+    void Hasher::learnFirstTier(const std::vector<Template> &templates, const std::vector<HashTable> &tables) {
+        assert(!templates.empty());
+        const size_t tier = std::min<size_t>(criteria->firstTierTables, tables.size());
+        const bool multiProbe = criteria->multiProbeMargin > 0;
+
+        // Scene windows are placed on a grid, so objects are up to half of window step away from the closest window
+        const int shift = criteria->windowStep / 2;
+        const cv::Point offsets[9] = {{0, 0}, {-shift, 0}, {shift, 0}, {0, -shift}, {0, shift},
+                                      {-shift, -shift}, {shift, -shift}, {-shift, shift}, {shift, shift}};
+        const int offsetsCount = shift > 0 ? 9 : 1;
+
+        // Votes of each template in windows shifted by each offset (-1 for templates without images)
+        std::vector<int> votes(templates.size() * offsetsCount, -1);
+
+        #pragma omp parallel for shared(templates, tables, votes, offsets) firstprivate(tier, multiProbe, offsetsCount)
+        for (size_t i = 0; i < templates.size(); ++i) {
+            const Template &t = templates[i];
+
+            // Templates loaded from file have no images to compute keys from
+            if (t.removed() || t.srcDepth.empty() || t.srcNormals.empty()) {
+                continue;
+            }
+
+            auto inside = [&t](const cv::Point &p) {
+                return p.x >= 0 && p.y >= 0 && p.x < t.srcDepth.cols && p.y < t.srcDepth.rows;
+            };
+
+            for (int o = 0; o < offsetsCount; ++o) {
+                const cv::Rect window(t.objBB.tl() + offsets[o], t.objBB.size());
+                int &v = votes[i * offsetsCount + o];
+                v = 0;
+
+                // Compute keys the same way detection does and vote if the template is stored at any of them
+                for (size_t j = 0; j < tier; ++j) {
+                    const Triplet &triplet = tables[j].triplet;
+                    if (!inside(triplet.c + window.tl()) || !inside(triplet.p1 + window.tl()) || !inside(triplet.p2 + window.tl())) {
+                        continue;
+                    }
+
+                    size_t keys[4];
+                    int count;
+
+                    if (multiProbe) {
+                        count = probeHashKeys(triplet, tables[j].binRanges, t.srcDepth, t.srcNormals, window, criteria->multiProbeMargin, keys);
+                    } else {
+                        HashKey key = validateTripletAndComputeHashKey(triplet, tables[j].binRanges, t.srcDepth, t.srcNormals, cv::Mat(), window);
+                        count = key.empty() ? 0 : 1;
+                        keys[0] = key.empty() ? 0 : key.hash();
+                    }
+
+                    for (int k = 0; k < count; ++k) {
+                        HashTable::Bucket bucket = tables[j][keys[k]];
+                        if (std::binary_search(bucket.begin(), bucket.end(), static_cast<ushort>(i))) {
+                            v++;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Keep threshold learned before if no template has images (e.g. only loaded templates are left)
+        votes.erase(std::remove(votes.begin(), votes.end(), -1), votes.end());
+        if (votes.empty()) {
+            return;
+        }
+
+        // Pick largest threshold, that keeps required fraction of shifted windows
+        std::sort(votes.rbegin(), votes.rend());
+        auto kept = static_cast<size_t>(std::ceil(criteria->firstTierRecall * votes.size()));
+        kept = std::min(std::max<size_t>(kept, 1), votes.size());
+        criteria->info.firstTierMinVotes = votes[kept - 1];
+    }
+
+    void Hasher::selectTables(size_t templatesCount, std::vector<HashTable> &tables) {
+        assert(templatesCount > 0);
+        const auto N = static_cast<double>(templatesCount);
+        std::vector<double> weights(templatesCount, 1.0);
+
+        // Sum of information of all templates in table, weighted by their current weight
+        auto score = [&](const HashTable &table) {
+            double sum = 0;
+
+            for (size_t key = 0; key < HASH_TABLE_KEYS; ++key) {
+                HashTable::Bucket bucket = table[key];
+                if (bucket.empty()) {
                     continue;
                 }
 
+                double weight = 0;
+                for (auto &handle : bucket) {
+                    weight += weights[handle];
+                }
+
+                sum += weight * std::log2(N / bucket.size());
+            }
+
+            return sum;
+        };
+
+        // Initial scores are upper bounds of scores in later iterations
+        std::vector<double> scores(tables.size());
+
+        #pragma omp parallel for shared(tables, scores)
+        for (size_t i = 0; i < tables.size(); ++i) {
+            scores[i] = score(tables[i]);
+        }
+
+        std::priority_queue<std::pair<double, size_t>> queue;
+        for (size_t i = 0; i < tables.size(); ++i) {
+            queue.emplace(scores[i], i);
+        }
+
+        std::vector<HashTable> selected;
+        while (selected.size() < criteria->tablesCount && !queue.empty()) {
+            auto top = queue.top();
+            queue.pop();
+
+            // Re-evaluate score of the best table, pick it if it's still better than bound of the next one
+            double current = score(tables[top.second]);
+            if (!queue.empty() && current < queue.top().first) {
+                queue.emplace(current, top.second);
+                continue;
+            }
+
+            // Decrease weights of templates covered by picked table
+            for (size_t key = 0; key < HASH_TABLE_KEYS; ++key) {
+                for (auto &handle : tables[top.second][key]) {
+                    weights[handle] = 1.0 / (1.0 / weights[handle] + 1.0);
+                }
+            }
+
+            selected.push_back(std::move(tables[top.second]));
+        }
+
+        tables = std::move(selected);
+    }
+
+    void Hasher::insert(std::vector<Template> &templates, const std::vector<uint> &handles, std::vector<HashTable> &tables) {
+        GridCache cache;
+        buildGridCache(templates, handles, cache);
+        fillTables(templates, handles, cache, tables);
+    }
+
+    void Hasher::fillTables(std::vector<Template> &templates, const std::vector<uint> &handles, const GridCache &cache,
+                            std::vector<HashTable> &tables) {
+        CV_Assert(templates.size() <= std::numeric_limits<ushort>::max() + 1u);
+        assert(cache.depth.rows == static_cast<int>(handles.size()));
+
+        #pragma omp parallel for shared(templates, handles, cache, tables) firstprivate(criteria)
+        for (size_t i = 0; i < tables.size(); i++) {
+            // Skip tables with no no defined ranges
+            if (tables[i].binRanges.empty()) {
+                continue;
+            }
+
+            // Tables with triplet outside of the grid (grid window changed since training) read template images directly
+            int cells[3];
+            const bool cached = tripletCells(tables[i].triplet, cache, cells);
+
+            for (size_t r = 0; r < handles.size(); ++r) {
+                const uint handle = handles[r];
+                Template &t = templates[handle];
+
                 // Validate and generate hash key at given triplet point
-                HashKey key = validateTripletAndComputeHashKey(tables[i].triplet, tables[i].binRanges, t.srcDepth, t.srcNormals, t.srcGray, t.objBB);
+                HashKey key = cached ? cachedHashKey(cells, tables[i].binRanges, cache, static_cast<int>(r)) :
+                              validateTripletAndComputeHashKey(tables[i].triplet, tables[i].binRanges, t.srcDepth, t.srcNormals, t.srcGray, t.objBB);
 
                 // Skip if validation failed, e.g. key is empty
                 if (key.empty()) {
@@ -165,85 +518,309 @@ namespace tless {
                 }
 
                 // Push unique templates to table
-                tables[i].pushUnique(key, t);
+                tables[i].pushUnique(key, handle);
             }
+
+            // Convert table to compact layout
+            tables[i].freeze();
         }
+    }
+
+    void Hasher::computeKeyMaps(const cv::Mat &depth, const cv::Mat &normals, const std::vector<HashTable> &tables, cv::Point origin,
+                                cv::Size grid, int step, std::vector<cv::Mat> &maps) {
+        assert(depth.type() == CV_16UC1);
+        assert(normals.type() == CV_8UC1);
+        assert(step > 0);
+
+        maps.resize(tables.size());
+
+        #pragma omp parallel for shared(depth, normals, tables, maps) firstprivate(origin, grid, step)
+        for (size_t i = 0; i < tables.size(); ++i) {
+            const Triplet &triplet = tables[i].triplet;
+            const std::vector<cv::Range> &binRanges = tables[i].binRanges;
+            maps[i].create(grid, CV_16UC1);
+
+            // Tables without bin ranges contain no templates
+            if (binRanges.empty()) {
+                maps[i].setTo(cv::Scalar(INVALID_KEY));
+                continue;
+            }
+
+            for (int gy = 0; gy < grid.height; ++gy) {
+                const int y = origin.y + gy * step;
+                auto *keys = maps[i].ptr<ushort>(gy);
+
+                // Pointers to triplet points of the first window in current grid row
+                const ushort *p1D = depth.ptr<ushort>(y + triplet.p1.y) + origin.x + triplet.p1.x;
+                const ushort *p2D = depth.ptr<ushort>(y + triplet.p2.y) + origin.x + triplet.p2.x;
+                const ushort *cD = depth.ptr<ushort>(y + triplet.c.y) + origin.x + triplet.c.x;
+                const uchar *n1 = normals.ptr<uchar>(y + triplet.p1.y) + origin.x + triplet.p1.x;
+                const uchar *n2 = normals.ptr<uchar>(y + triplet.p2.y) + origin.x + triplet.p2.x;
+                const uchar *n3 = normals.ptr<uchar>(y + triplet.c.y) + origin.x + triplet.c.x;
+
+                for (int gx = 0, o = 0; gx < grid.width; ++gx, o += step) {
+                    keys[gx] = INVALID_KEY;
+
+                    // Validate quantized normals and depths
+                    if (n1[o] == 0 || n2[o] == 0 || n3[o] == 0 || p1D[o] == 0 || p2D[o] == 0 || cD[o] == 0) {
+                        continue;
+                    }
+
+                    // Quantize depth differences
+                    uchar d1 = quantizeDepth(static_cast<int>(p1D[o]) - cD[o], binRanges);
+                    uchar d2 = quantizeDepth(static_cast<int>(p2D[o]) - cD[o], binRanges);
 
-        // Pick only first 100 tables with the most quantized templates
-        std::stable_sort(tables.rbegin(), tables.rend());
-        tables.resize(criteria->tablesCount);
+                    if (d1 == 0 || d2 == 0) {
+                        continue;
+                    }
+
+                    keys[gx] = static_cast<ushort>(HashKey(d1, d2, n1[o], n2[o], n3[o]).hash());
+                }
+            }
+        }
     }
 
-    void Hasher::verifyCandidates(const cv::Mat &depth, const cv::Mat &normals, std::vector<HashTable> &tables, std::vector<Window> &windows) {
+    void Hasher::verifyCandidates(const cv::Mat &depth, const cv::Mat &normals, std::vector<HashTable> &tables, const FeatureStore &store,
+                                  std::vector<Window> &windows) {
         assert(!normals.empty());
         assert(!depth.empty());
         assert(!windows.empty());
         assert(!tables.empty());
+        assert(store.size() > 0);
+        assert(tables.size() <= std::numeric_limits<ushort>::max());
         assert(criteria->info.largestArea.area() > 0);
 
-        // Define candidates array size
+        const auto minVotes = static_cast<ushort>(std::max(criteria->minVotes, 1));
+        const bool multiProbe = criteria->multiProbeMargin > 0;
+
+        // Table ranges of hashing cascade tiers (first tier is empty when cascade is disabled)
+        const size_t firstTier = std::min<size_t>(criteria->firstTierTables, tables.size());
+        const size_t tiers[3] = {0, firstTier, tables.size()};
+        const auto firstTierMinVotes = static_cast<ushort>(std::max(criteria->info.firstTierMinVotes, 0));
+
+        // Dense buckets vote using bit-sliced counters, wide enough to count one vote from each table
+        const auto words = static_cast<int>((store.size() + 63) / 64);
+        int planesCount = 1;
+        while ((size_t(1) << planesCount) <= tables.size()) {
+            planesCount++;
+        }
+
+        // Compute hash keys for all windows on the grid at once, grid spans top left corners of all windows
+        const int step = criteria->windowStep;
+        cv::Point origin(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+        cv::Size grid;
+
+        if (criteria->denseHashKeys && !multiProbe) {
+            cv::Point last(0, 0);
+            for (auto &window : windows) {
+                origin.x = std::min(origin.x, window.tl().x);
+                origin.y = std::min(origin.y, window.tl().y);
+                last.x = std::max(last.x, window.tl().x);
+                last.y = std::max(last.y, window.tl().y);
+            }
+
+            grid = cv::Size((last.x - origin.x) / step + 1, (last.y - origin.y) / step + 1);
+            computeKeyMaps(depth, normals, tables, origin, grid, step, keyMaps);
+        }
+
+#ifndef VIZ_HASHING
+        #pragma omp parallel default(none) shared(depth, normals, tables, windows, store) firstprivate(minVotes, multiProbe, tiers, firstTierMinVotes, words, planesCount, step, origin, grid)
+#endif
+        {
+            // Thread local vote counters (one for each template handle) and list of handles that received any vote
+            std::vector<ushort> votes(store.size(), 0);
+            std::vector<ushort> touched;
+            std::vector<HashTable::Bucket> buckets;
+            touched.reserve(store.size());
+            buckets.reserve(tables.size());
+
+            // Bit-sliced counters, union of dense buckets each window voted with and mask of counters passing a threshold
+            std::vector<uint64> planes(static_cast<size_t>(planesCount * words), 0), voted(static_cast<size_t>(words), 0);
+            std::vector<uint64> passing(static_cast<size_t>(words), 0);
 #ifdef VIZ_HASHING
-        std::vector<Template *> usedTemplates;
+            std::vector<std::vector<Triplet>> triplets(store.size());
+            std::vector<Triplet> bucketTriplets;
 #endif
-        const size_t candidatesSize = criteria->info.maxId + 2;
+
+            // Orders handles by votes descending
+            auto byVotes = [&votes](ushort h1, ushort h2) {
+                return votes[h1] > votes[h2];
+            };
+
+            // Reads bit-sliced counter of one handle
+            auto denseVotes = [&planes, &voted, words, planesCount](ushort handle) {
+                const int w = handle / 64, bit = handle % 64;
+                ushort count = 0;
+
+                for (int p = 0; ((voted[w] >> bit) & 1) && p < planesCount; ++p) {
+                    count |= ((planes[p * words + w] >> bit) & 1) << p;
+                }
+
+                return count;
+            };
 
 #ifndef VIZ_HASHING
-        #pragma omp parallel for default(none) shared(depth, normals, tables, windows) firstprivate(candidatesSize)
+            #pragma omp for
 #endif
-        for (size_t i = 0; i < windows.size(); ++i) {
-            std::vector<std::pair<Template*, int>> candidates(candidatesSize);
+            for (size_t i = 0; i < windows.size(); ++i) {
+                // Windows placed on the grid look up their keys in key maps
+                const cv::Point g = windows[i].tl() - origin;
+                const bool onGrid = criteria->denseHashKeys && !multiProbe && g.x % step == 0 && g.y % step == 0 && g.x / step < grid.width &&
+                                    g.y / step < grid.height;
+
+                // Vote in first tier of tables, windows which best template doesn't get enough votes skip the second tier
+                bool rejected = false, dense = false;
+                for (int tier = 0; tier < 2 && !rejected; ++tier) {
+                    if (tiers[tier] == tiers[tier + 1]) {
+                        continue;
+                    }
 
-            for (auto &table : tables) {
-                // Validate and generate hash key at given triplet point
-                HashKey key = validateTripletAndComputeHashKey(table.triplet, table.binRanges, depth, normals, cv::Mat(), windows[i].rect());
+                    buckets.clear();
+#ifdef VIZ_HASHING
+                    bucketTriplets.clear();
+#endif
 
-                // Skip if validation failed, e.g. key is empty
-                if (key.empty()) {
-                    continue;
-                }
+                    for (size_t t = tiers[tier]; t < tiers[tier + 1]; ++t) {
+                        size_t hashes[4];
+                        int probes = 1;
+
+                        if (onGrid) {
+                            ushort mapped = keyMaps[t].at<ushort>(g.y / step, g.x / step);
+
+                            // Skip invalid keys
+                            if (mapped == INVALID_KEY) {
+                                continue;
+                            }
+
+                            hashes[0] = mapped;
+                        } else if (multiProbe) {
+                            // Compute key and keys of adjacent depth bins
+                            probes = probeHashKeys(tables[t].triplet, tables[t].binRanges, depth, normals, windows[i].rect(),
+                                                   criteria->multiProbeMargin, hashes);
+                        } else {
+                            // Validate and generate hash key at given triplet point
+                            HashKey key = validateTripletAndComputeHashKey(tables[t].triplet, tables[t].binRanges, depth, normals, cv::Mat(), windows[i].rect());
+
+                            // Skip if validation failed, e.g. key is empty
+                            if (key.empty()) {
+                                continue;
+                            }
+
+                            hashes[0] = key.hash();
+                        }
+
+                        // Collect buckets first and prefetch them, so they're ready once voting starts
+                        for (int p = 0; p < probes; ++p) {
+                            buckets.push_back(tables[t][hashes[p]]);
+                            __builtin_prefetch(buckets.back().first);
+#ifdef VIZ_HASHING
+                            bucketTriplets.push_back(tables[t].triplet);
+#endif
+                        }
+                    }
+
+                    // Vote for each template in collected buckets, remember handles that were voted for the first time (each template
+                    // is stored at one key of each table, so probed keys of one table never vote for the same template twice)
+                    for (size_t b = 0; b < buckets.size(); ++b) {
+#ifndef VIZ_HASHING
+                        // Dense buckets are added as bitsets
+                        if (buckets[b].bits != nullptr) {
+                            addBitSliced(planes.data(), words, planesCount, buckets[b].bits, voted.data(), static_cast<int>(buckets[b].words));
+                            dense = true;
+                            continue;
+                        }
+#endif
 
-                // Vote for each template in hash table at specific key and push unique to window candidates
-                for (auto &entry : table.templates[key.hash()]) {
-                    candidates[entry->id].first = entry;
-                    candidates[entry->id].second++;
+                        for (auto &handle : buckets[b]) {
+                            if (votes[handle]++ == 0) {
+                                touched.push_back(handle);
+                            }
 #ifdef VIZ_HASHING
-                    entry->triplets.push_back(table.triplet);
-                    entry->votes++;
-                    usedTemplates.push_back(entry);
+                            triplets[handle].push_back(bucketTriplets[b]);
 #endif
+                        }
+                    }
+
+                    // Check if the best template after first tier has enough votes, counters of dense buckets are compared word-parallel
+                    // (windows without any vote pass too, if the learned threshold is 0)
+                    if (tier == 0) {
+                        rejected = firstTierMinVotes > 0;
+                        for (size_t h = 0; h < touched.size() && rejected; ++h) {
+                            rejected = votes[touched[h]] + (dense ? denseVotes(touched[h]) : 0) < firstTierMinVotes;
+                        }
+
+                        if (rejected && dense) {
+                            compareBitSliced(planes.data(), words, planesCount, firstTierMinVotes, voted.data(), passing.data(), words);
+                            rejected = std::all_of(passing.begin(), passing.end(), [](uint64 mask) { return mask == 0; });
+                        }
+                    }
                 }
-            }
 
-            // Sort first N elements by their votes descending
-            std::nth_element(candidates.begin(), candidates.begin() + criteria->maxCandidates, candidates.end(),
-                             [](const std::pair<Template*,int> &p1, const std::pair<Template*,int> &p2) {
-                                 return p1.second > p2.second;
-                             });
+                // Merge bit-sliced counters to vote counters, handles voted only in dense buckets are extracted only if they pass minVotes
+                if (dense) {
+                    if (!rejected) {
+                        for (auto &handle : touched) {
+                            votes[handle] += denseVotes(handle);
+                        }
+
+                        compareBitSliced(planes.data(), words, planesCount, minVotes, voted.data(), passing.data(), words);
+                        for (int w = 0; w < words; ++w) {
+                            for (uint64 mask = passing[w]; mask != 0; mask &= mask - 1) {
+                                const auto handle = static_cast<ushort>(w * 64 + __builtin_ctzll(mask));
+
+                                if (votes[handle] == 0) {
+                                    votes[handle] = denseVotes(handle);
+                                    touched.push_back(handle);
+                                }
+                            }
+                        }
+                    }
 
-            // Push first N elements to windows.candidates with largest amount of votes
-            for (int j = 0; j < criteria->maxCandidates; ++j) {
-                if (candidates[j].first != nullptr && candidates[j].second >= criteria->minVotes) {
-                    windows[i].candidates.push_back(candidates[j].first);
+                    // Clear counters of voted words
+                    for (int w = 0; w < words; ++w) {
+                        if (voted[w] != 0) {
+                            voted[w] = 0;
+                            for (int p = 0; p < planesCount; ++p) {
+                                planes[p * words + w] = 0;
+                            }
+                        }
+                    }
                 }
-            }
 
-#ifdef VIZ_HASHING
-            // Sort candidates based on the votes
-            std::stable_sort(windows[i].candidates.begin(), windows[i].candidates.end(), [](Template *t1, Template *t2) { return t1->votes > t2->votes; });
+                // Move handles with enough votes to the front (partition keeps all handles for the reset below)
+                auto last = std::partition(touched.begin(), touched.end(), [&votes, minVotes, rejected](ushort handle) {
+                    return !rejected && votes[handle] >= minVotes;
+                });
 
-            // Save votes for current window in separate array
-            for (auto &candidate : windows[i].candidates) {
-                windows[i].votes.push_back(candidate->votes);
-                windows[i].triplets.push_back(candidate->triplets);
-            }
+                // Select N handles with the most votes, selection runs only over voted handles
+                auto selected = std::min<size_t>(static_cast<size_t>(last - touched.begin()), criteria->maxCandidates);
+                std::nth_element(touched.begin(), touched.begin() + selected, last, byVotes);
 
-            for (auto &t : usedTemplates) {
-                t->triplets.clear();
-                t->votes = 0;
-            }
+#ifdef VIZ_HASHING
+                // Sort candidates based on the votes
+                std::stable_sort(touched.begin(), touched.begin() + selected, byVotes);
+#endif
 
-            usedTemplates.clear();
+                // Push selected handles to windows.candidates
+                for (size_t j = 0; j < selected; ++j) {
+                    windows[i].candidates.push_back(touched[j]);
+#ifdef VIZ_HASHING
+                    // Save votes and triplets for current window in separate arrays (candidates are sorted by votes)
+                    windows[i].votes.push_back(votes[touched[j]]);
+                    windows[i].triplets.push_back(triplets[touched[j]]);
 #endif
+                }
+
+                // Sparse reset of vote counters
+                for (auto it = touched.begin(); it != touched.end(); ++it) {
+                    votes[*it] = 0;
+#ifdef VIZ_HASHING
+                    triplets[*it].clear();
+#endif
+                }
+
+                touched.clear();
+            }
         }
 
         // Clear empty indexes
@@ -3,9 +3,11 @@
 
 #include <opencv2/opencv.hpp>
 #include <memory>
+#include <limits>
 #include "../core/hash_table.h"
 #include "../core/classifier_criteria.h"
 #include "../core/window.h"
+#include "../core/feature_store.h"
 
 namespace tless {
     /**
@@ -13,7 +15,21 @@ namespace tless {
      */
     class Hasher {
     private:
+        static const ushort INVALID_KEY = std::numeric_limits<ushort>::max(); //!< Marks grid positions with invalid hash key in key maps
+
+        /**
+         * @brief Gray, quantized normal and depth values of templates at each cell of criteria.tripletGrid (training only).
+         *
+         * Triplet points can only be placed at grid cells, so hash keys of all tables are computed from this
+         * compact cache instead of reading template images again for each table.
+         */
+        struct GridCache {
+            std::vector<cv::Point> cells; //!< Position of each grid cell relative to template bounding box
+            cv::Mat gray, normals, depth; //!< One row for each cached template, one column for each grid cell
+        };
+
         cv::Ptr<ClassifierCriteria> criteria;
+        std::vector<cv::Mat> keyMaps; //!< Hashed keys of each table at each window grid position, reused across pyramid levels
 
         /**
          * @brief Validates and generates hash key at triplet position if it's valid.
@@ -36,13 +52,105 @@ namespace tless {
         HashKey validateTripletAndComputeHashKey(const Triplet &triplet, const std::vector<cv::Range> &binRanges, const cv::Mat &depth, const cv::Mat &normals,
                                               const cv::Mat &gray, cv::Rect window, uchar minGray = 40);
 
+        /**
+         * @brief Computes all hash keys a window should vote for in one table when multi-probe hashing is enabled.
+         *
+         * Validation is the same as in validateTripletAndComputeHashKey(). Each relative depth closer to a boundary
+         * of its bin than margin * bin width also probes the adjacent bin, yielding up to 4 keys.
+         *
+         * @param[in]  triplet   Triplet of the hash table
+         * @param[in]  binRanges Bin ranges of quantized depths of the hash table
+         * @param[in]  depth     16-bit depth image to compute relative depths from
+         * @param[in]  normals   8-bit uchar image of quantized normals
+         * @param[in]  window    Triplet positions are being offset to this window
+         * @param[in]  margin    Fraction of bin width defining neighbourhood of bin boundaries
+         * @param[out] keys      Hashed keys to probe (HashKey::hash())
+         * @return               Number of keys to probe (0 if validation failed)
+         */
+        int probeHashKeys(const Triplet &triplet, const std::vector<cv::Range> &binRanges, const cv::Mat &depth, const cv::Mat &normals,
+                          cv::Rect window, float margin, size_t keys[4]);
+
+        /**
+         * @brief Reads values of templates at each triplet grid cell into grid cache.
+         *
+         * @param[in]  templates Array of templates
+         * @param[in]  handles   Handles of templates to cache, row r of the cache holds template handles[r]
+         * @param[out] cache     Computed grid cache
+         */
+        void buildGridCache(const std::vector<Template> &templates, const std::vector<uint> &handles, GridCache &cache);
+
+        /**
+         * @brief Finds grid cells of triplet points.
+         *
+         * @param[in]  triplet Triplet to find cells for
+         * @param[in]  cache   Grid cache
+         * @param[out] cells   Indices of cells of (c, p1, p2) points
+         * @return             False if any of the points doesn't lie at grid cell (e.g. grid window changed after training)
+         */
+        bool tripletCells(const Triplet &triplet, const GridCache &cache, int cells[3]);
+
+        /**
+         * @brief Validates and generates hash key from grid cache, the same way as validateTripletAndComputeHashKey().
+         *
+         * @param[in] cells     Indices of cells of triplet (c, p1, p2) points
+         * @param[in] binRanges Array of binRanges of quantized depths (if empty, hash key gets random valid depths)
+         * @param[in] cache     Grid cache
+         * @param[in] row       Row of the template in grid cache
+         * @param[in] minGray   Minimum value of gray image to be considered as containing object
+         * @return              Returns valid HashKey if all points and quantized values were valid, otherwise returns empty HashKey
+         */
+        HashKey cachedHashKey(const int cells[3], const std::vector<cv::Range> &binRanges, const GridCache &cache, int row,
+                              uchar minGray = 40);
+
         /**
          * @brief Computes bin ranges for each table (triplet) across all templates based on relative depths.
          *
          * @param[in]     templates Input array of all templates parsed for detection
+         * @param[in]     cache     Grid cache of all templates
          * @param[in,out] tables    Input array of tables, which are then updated with their computed bin range
          */
-        void initializeBinRanges(std::vector<Template> &templates, std::vector<HashTable> &tables);
+        void initializeBinRanges(std::vector<Template> &templates, const GridCache &cache, std::vector<HashTable> &tables);
+
+        /**
+         * @brief Pushes templates to tables at their hash keys and freezes tables.
+         *
+         * @param[in]     templates Array of all templates, handle of each template is it's index in this array
+         * @param[in]     handles   Handles of templates to push (rows of grid cache)
+         * @param[in]     cache     Grid cache of templates in handles
+         * @param[in,out] tables    Tables to fill
+         */
+        void fillTables(std::vector<Template> &templates, const std::vector<uint> &handles, const GridCache &cache,
+                        std::vector<HashTable> &tables);
+
+        /**
+         * @brief Computes hashed keys of each table for all windows placed on a regular grid (dense key maps).
+         *
+         * Triplet points are fixed offsets from window.tl(), so each grid row of a key map reads the same
+         * 6 rows of depth and normals images sequentially. Validation matches validateTripletAndComputeHashKey().
+         *
+         * @param[in]  depth   16-bit Scene depth image
+         * @param[in]  normals 8-bit Image of quantized surface normals of scene depth image
+         * @param[in]  tables  Array of trained hash tables
+         * @param[in]  origin  Top left corner of the first window in the grid
+         * @param[in]  grid    Number of grid positions in each direction
+         * @param[in]  step    Distance between neighbouring grid positions (criteria.windowStep)
+         * @param[out] maps    16-bit key map for each table, invalid keys are set to INVALID_KEY
+         */
+        void computeKeyMaps(const cv::Mat &depth, const cv::Mat &normals, const std::vector<HashTable> &tables, cv::Point origin,
+                            cv::Size grid, int step, std::vector<cv::Mat> &maps);
+
+        /**
+         * @brief Picks criteria.tablesCount complementary tables from trained tables (criteria.greedyTableSelection).
+         *
+         * Each template hashed by a table gains log2(N / bucket size) bits of information (bucket entropy), weighted
+         * by 1 / (1 + number of already picked tables containing the template). Tables are picked greedily by this score,
+         * which favours tables with small buckets covering templates other tables miss. Scores only decrease as weights
+         * decrease, so they are re-evaluated lazily.
+         *
+         * @param[in]     templatesCount Number of templates tables were trained on
+         * @param[in,out] tables         Trained tables, only picked tables are kept (in order they were picked)
+         */
+        void selectTables(size_t templatesCount, std::vector<HashTable> &tables);
 
     public:
         Hasher(cv::Ptr<ClassifierCriteria> criteria) : criteria(criteria) {}
@@ -61,6 +169,29 @@ namespace tless {
          */
         void train(std::vector<Template> &templates, std::vector<HashTable> &tables);
 
+        /**
+         * @brief Inserts templates into already trained hash tables, using their fixed triplets and bin ranges.
+         *
+         * @param[in]     templates Array of all templates, handle of each template is it's index in this array
+         * @param[in]     handles   Handles of templates to insert (e.g. reused handles of removed templates)
+         * @param[in,out] tables    Trained hash tables, each table is frozen again after insertion
+         */
+        void insert(std::vector<Template> &templates, const std::vector<uint> &handles, std::vector<HashTable> &tables);
+
+        /**
+         * @brief Learns threshold of the first tier of hashing cascade (criteria.info.firstTierMinVotes).
+         *
+         * Scene windows rarely align with objects, so keys of each template are computed the same way detection does
+         * in windows shifted by up to half of criteria.windowStep. Template votes for itself in every first tier table
+         * it's stored at one of these keys, threshold is the largest number of votes at least criteria.firstTierRecall
+         * of shifted windows reach. Removed templates and templates without images (loaded from file) are ignored,
+         * the threshold is kept if there are no templates left to learn it from.
+         *
+         * @param[in] templates Templates tables were trained on (or inserted to)
+         * @param[in] tables    Trained tables, first criteria.firstTierTables tables form the first tier
+         */
+        void learnFirstTier(const std::vector<Template> &templates, const std::vector<HashTable> &tables);
+
         /**
          * @brief Picks first 100 best candidates for each window from included hashing tables.
          *
@@ -72,9 +203,11 @@ namespace tless {
          * @param[in]     depth   16-bit Scene depth image
          * @param[in]     normals 8-bit Image of quantized surface normals of scene depth image
          * @param[in]     tables  Array of pre-computed tables (with generated triplets) in training stage
+         * @param[in]     store   Feature store of templates the tables were trained on (defines range of template handles)
          * @param[in,out] windows Array of windows that passed objectness detection test
          */
-        void verifyCandidates(const cv::Mat &depth, const cv::Mat &normals, std::vector<HashTable> &tables, std::vector<Window> &windows);
+        void verifyCandidates(const cv::Mat &depth, const cv::Mat &normals, std::vector<HashTable> &tables, const FeatureStore &store,
+                              std::vector<Window> &windows);
     };
 }
 
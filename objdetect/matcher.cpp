@@ -1,5 +1,6 @@
 #include <random>
 #include <algorithm>
+#include <numeric>
 #include <utility>
 #include "matcher.h"
 #include "../core/triplet.h"
@@ -10,6 +11,7 @@
 #include "../core/template.h"
 #include "../core/classifier_criteria.h"
 #include "../processing/computation.h"
+#include "../processing/kernels.h"
 
 namespace tless {
     void Matcher::selectScatteredFeaturePoints(const std::vector<std::pair<cv::Point, uchar>> &points, uint count, std::vector<cv::Point> &scattered) {
@@ -50,6 +52,9 @@ namespace tless {
         assert(minStableVal > 0);
         assert(minEdgeMag > 0);
 
+        // Precompute hue bins used in color test
+        initHueBins();
+
 #ifndef VIZ_TPL_FEATURES
         #pragma omp parallel for shared(templates) firstprivate(criteria, minStableVal, minEdgeMag)
 #endif
@@ -116,22 +121,85 @@ namespace tless {
         }
     }
 
-    int Matcher::depthDiffMedian(const cv::Mat &sceneDepth, const std::vector<cv::Point> &stablePoints, const std::vector<ushort> &tplDepths) {
-        std::vector<int> diffs(stablePoints.size());
+    void Matcher::sortFeaturePoints(std::vector<Template> &templates) {
+        std::vector<int> normalsFreq(256, 0), gradientsFreq(256, 0);
+
+        // Count frequency of each quantized feature across all templates
+        for (auto &t : templates) {
+            if (t.removed()) {
+                continue;
+            }
+
+            for (uint i = 0; i < criteria->featurePointsCount; ++i) {
+                normalsFreq[t.features.normals[i]]++;
+                gradientsFreq[t.features.gradients[i]]++;
+            }
+        }
+
+        // Invalid features never match, so they're always evaluated first
+        normalsFreq[0] = gradientsFreq[0] = 0;
+
+        #pragma omp parallel for shared(templates, normalsFreq, gradientsFreq)
+        for (size_t i = 0; i < templates.size(); i++) {
+            Template &t = templates[i];
+            if (t.removed()) {
+                continue;
+            }
+
+            const uint N = criteria->featurePointsCount;
+            std::vector<uint> stableOrder(N), edgeOrder(N);
+            std::iota(stableOrder.begin(), stableOrder.end(), 0);
+            std::iota(edgeOrder.begin(), edgeOrder.end(), 0);
+
+            // Sort ascending by feature frequency (stable sort retains order of scattered points with equal frequency)
+            std::stable_sort(stableOrder.begin(), stableOrder.end(), [&t, &normalsFreq](uint a, uint b) {
+                return normalsFreq[t.features.normals[a]] < normalsFreq[t.features.normals[b]];
+            });
+            std::stable_sort(edgeOrder.begin(), edgeOrder.end(), [&t, &gradientsFreq](uint a, uint b) {
+                return gradientsFreq[t.features.gradients[a]] < gradientsFreq[t.features.gradients[b]];
+            });
+
+            // Apply new order to feature points and their features
+            const std::vector<cv::Point> stablePoints = t.stablePoints, edgePoints = t.edgePoints;
+            const std::vector<uchar> normals = t.features.normals, gradients = t.features.gradients, hue = t.features.hue;
+            const std::vector<ushort> depths = t.features.depths;
+
+            for (uint j = 0; j < N; ++j) {
+                t.stablePoints[j] = stablePoints[stableOrder[j]];
+                t.features.normals[j] = normals[stableOrder[j]];
+                t.features.depths[j] = depths[stableOrder[j]];
+                t.features.hue[j] = hue[stableOrder[j]];
+                t.edgePoints[j] = edgePoints[edgeOrder[j]];
+                t.features.gradients[j] = gradients[edgeOrder[j]];
+            }
+        }
+    }
+
+    int Matcher::depthDiffMedian(const cv::Mat &sceneDepth, const std::vector<cv::Point> &stablePoints, const ushort *tplDepths) {
+        int diffs[MAX_FEATURE_POINTS];
+        int count = 0;
+        assert(stablePoints.size() <= MAX_FEATURE_POINTS);
 
         // Accumulate depth differences
         for (uint i = 0; i < stablePoints.size(); i++) {
-            ushort d = sceneDepth.at<ushort>(stablePoints[i]);
+            const cv::Point &p = stablePoints[i];
+
+            // Template points in larger templates can go beyond scene boundaries
+            if (p.x < 0 || p.y < 0 || p.x >= sceneDepth.cols || p.y >= sceneDepth.rows) {
+                continue;
+            }
+
+            ushort d = sceneDepth.at<ushort>(p);
 
             // Skip invalid depth pixels
             if (d == 0) {
                 continue;
             }
 
-            diffs[i] = tplDepths[i] - d;
+            diffs[count++] = tplDepths[i] - d;
         }
 
-        return median<int>(diffs);
+        return median<int>(diffs, diffs + count);
     }
 
     bool Matcher::testObjectSize(const cv::Mat &sceneDepth, const cv::Point winCenter, ushort avgDepth) {
@@ -150,7 +218,25 @@ namespace tless {
         return false;
     }
 
-    int Matcher::testDepth(const cv::Mat &sceneDepth, const cv::Point &stable, ushort depth, int depthMedian, float diameter) {
+    int Matcher::testDepth(const ScenePyramid &scene, const cv::Point &stable, ushort depth, int depthMedian, float diameter) {
+        const cv::Mat &sceneDepth = scene.srcDepth;
+        const int expected = depth - depthMedian;
+
+        // Use depth extremes in the patch around feature point to decide without scanning the patch
+        if (stable.x >= 0 && stable.y >= 0 && stable.x < sceneDepth.cols && stable.y < sceneDepth.rows) {
+            const int dMin = scene.spreadMinDepth.at<ushort>(stable);
+            const int dMax = scene.spreadMaxDepth.at<ushort>(stable);
+
+            if (std::abs(expected - dMin) < diameter || std::abs(expected - dMax) < diameter) {
+                return 1;
+            }
+
+            // Both extremes failed on the same side of the expected depth, no value in the patch can match
+            if (dMax < expected || dMin > expected) {
+                return 0;
+            }
+        }
+
         for (int y = -criteria->patchOffset; y <= criteria->patchOffset; ++y) {
             for (int x = -criteria->patchOffset; x <= criteria->patchOffset; ++x) {
                 // Apply needed offsets to feature point
@@ -170,7 +256,22 @@ namespace tless {
         return 0;
     }
 
-    int Matcher::testColor(const cv::Mat &sceneHue, const cv::Point &stable, uchar hue) {
+    int Matcher::testColor(const ScenePyramid &scene, const cv::Point &stable, uchar hue) {
+        const cv::Mat &sceneHue = scene.srcHue;
+
+        // Use spread hue bins in the patch around feature point to decide without scanning the patch
+        if (stable.x >= 0 && stable.y >= 0 && stable.x < sceneHue.cols && stable.y < sceneHue.rows) {
+            const uint64 bins = scene.spreadHue.at<uint64>(stable);
+
+            if (bins & hueSureBins[hue]) {
+                return 1;
+            }
+
+            if (!(bins & hueMaybeBins[hue])) {
+                return 0;
+            }
+        }
+
         for (int y = -criteria->patchOffset; y <= criteria->patchOffset; ++y) {
             for (int x = -criteria->patchOffset; x <= criteria->patchOffset; ++x) {
                 // Apply needed offsets to feature point
@@ -190,7 +291,313 @@ namespace tless {
         return 0;
     }
 
-    void Matcher::match(ScenePyramid &scene, std::vector<Window> &windows, std::vector<Match> &matches) {
+    void Matcher::initHueBins() {
+        for (int h = 0; h < 256; ++h) {
+            hueSureBins[h] = hueMaybeBins[h] = 0;
+
+            for (int b = 0; b < HUE_BINS; ++b) {
+                // Count hue values of this bin, that are close enough to template hue
+                int close = 0;
+                for (int v = b * HUE_BIN_WIDTH; v < (b + 1) * HUE_BIN_WIDTH; ++v) {
+                    close += std::abs(h - v) < criteria->maxHueDiff;
+                }
+
+                if (close == HUE_BIN_WIDTH) {
+                    hueSureBins[h] |= 1ull << b;
+                }
+
+                if (close > 0) {
+                    hueMaybeBins[h] |= 1ull << b;
+                }
+            }
+        }
+    }
+
+    bool Matcher::testDepthAndColor(const ScenePyramid &scene, const TemplateFeatures &candidate, const std::vector<cv::Point> &offsetStable,
+                                    int minThreshold, float &sIV, float &sV, CascadeStats &stats) {
+        const auto N = static_cast<int>(criteria->featurePointsCount);
+        const int maxScore = criteria->earlyAccept ? minThreshold : N;
+        int i;
+
+        // Test IV
+        // Calculate depth median accross differences
+        int depthMedian = depthDiffMedian(scene.srcDepth, offsetStable, candidate.depths);
+        float diameter = candidate.diameter * criteria->info.depthScaleFactor * criteria->depthK;
+
+        // Perform depth test over stable points, stop once min threshold can't be reached
+        for (i = 0; i < N && sIV + (N - i) >= minThreshold && sIV < maxScore; i++) {
+            sIV += testDepth(scene, offsetStable[i], candidate.depths[i], depthMedian, diameter);
+        }
+
+        stats.evaluated[2]++;
+        stats.points[2] += i;
+        if (sIV < minThreshold) return false;
+        stats.passed[3]++;
+
+        // Test V
+        for (i = 0; i < N && sV + (N - i) >= minThreshold && sV < maxScore; i++) {
+            sV += testColor(scene, offsetStable[i], candidate.hue[i]);
+        }
+
+        stats.evaluated[3]++;
+        stats.points[3] += i;
+        if (sV < minThreshold) return false;
+        stats.passed[4]++;
+
+        return true;
+    }
+
+    void Matcher::accumulateResponses(const std::vector<cv::Mat> &maps, const short *xs, const short *ys, const uchar *features,
+                                      int gridW, int lo, int hi, std::vector<uchar> &acc) {
+        const int T = criteria->windowStep;
+        const int area = maps[0].cols;
+        std::fill(acc.begin() + lo, acc.begin() + hi + 1, 0);
+
+        for (uint i = 0; i < criteria->featurePointsCount; ++i) {
+            // Features are single quantized orientations, invalid ones can never match
+            if (features[i] == 0) {
+                continue;
+            }
+
+            auto o = static_cast<size_t>(__builtin_ctz(features[i]));
+            assert(o < maps.size());
+
+            // Shift response map to feature point, so window at grid index k reads its response at position k
+            const int cellX = xs[i] / T;
+            const int start = (ys[i] / T) * gridW + cellX;
+            const uchar *row = maps[o].ptr<uchar>((ys[i] % T) * T + xs[i] % T) + start;
+
+            // Windows reading beyond the response map (template goes out of the scene) don't get any response
+            const int end = std::min(hi + 1, area - start);
+
+            // Add responses one grid row at a time, windows whose feature point column overflows the grid row would
+            // otherwise read responses from the next row (left side of the scene), they don't get any response either
+            for (int rowStart = (lo / gridW) * gridW; rowStart < end; rowStart += gridW) {
+                const int first = std::max(lo, rowStart);
+                const int last = std::min(end, rowStart + gridW - cellX);
+
+                if (last > first) {
+                    addResponses(acc.data() + first, row + first, last - first);
+                }
+            }
+        }
+    }
+
+    void Matcher::groupCandidates(const std::vector<Window> &windows, std::vector<std::pair<uint, int>> &pairs, std::vector<size_t> &groups) {
+        pairs.clear();
+        groups.clear();
+
+        for (int l = 0; l < windows.size(); l++) {
+            for (auto &candidate : windows[l].candidates) {
+                pairs.emplace_back(candidate, l);
+            }
+        }
+
+        std::sort(pairs.begin(), pairs.end());
+
+        // Save start index of each group
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            if (i == 0 || pairs[i].first != pairs[i - 1].first) {
+                groups.push_back(i);
+            }
+        }
+        groups.push_back(pairs.size());
+    }
+
+    bool Matcher::testCandidate(const ScenePyramid &scene, const TemplateFeatures &candidate, const int *linStable, const int *linEdge,
+                                const cv::Point &winTl, const cv::Point &winCenter, int minThreshold, std::vector<cv::Point> &offsetStable,
+                                float &score, CascadeStats &stats) {
+        const auto N = criteria->featurePointsCount;
+        const auto winOffset = static_cast<int>(winTl.y * scene.spreadNormals.step + winTl.x);
+        const int maxScore = criteria->earlyAccept ? minThreshold : static_cast<int>(N);
+        int evaluated = 0;
+
+        // Scores for each test
+        float sII = 0, sIII = 0, sIV = 0, sV = 0;
+
+        // TEST I
+        stats.candidates++;
+        if (!testObjectSize(scene.srcDepth, winCenter, candidate.avgDepth)) return false;
+        stats.passed[0]++;
+
+        // Test II
+        sII = matchFeatures(scene.spreadNormals.ptr<uchar>() + winOffset, linStable, candidate.normals, N, minThreshold, maxScore, &evaluated);
+        stats.evaluated[0]++;
+        stats.points[0] += evaluated;
+
+        if (sII < minThreshold) return false;
+        stats.passed[1]++;
+
+        // Test III
+        sIII = matchFeatures(scene.spreadGradients.ptr<uchar>() + winOffset, linEdge, candidate.gradients, N, minThreshold, maxScore, &evaluated);
+        stats.evaluated[1]++;
+        stats.points[1] += evaluated;
+
+        if (sIII < minThreshold) return false;
+        stats.passed[2]++;
+
+        // Offset stable feature points to coordinates of current window
+        for (uint i = 0; i < N; ++i) {
+            offsetStable[i] = cv::Point(candidate.stableX[i] + winTl.x, candidate.stableY[i] + winTl.y);
+        }
+
+        // Test IV and V
+        if (!testDepthAndColor(scene, candidate, offsetStable, minThreshold, sIV, sV, stats)) return false;
+
+        score = (sII / N) + (sIII / N) + (sIV / N) + (sV / N);
+        return true;
+    }
+
+    void Matcher::linearOffsets(const TemplateFeatures &candidate, int step, int *linStable, int *linEdge) {
+        for (uint i = 0; i < criteria->featurePointsCount; ++i) {
+            linStable[i] = candidate.stableY[i] * step + candidate.stableX[i];
+            linEdge[i] = candidate.edgeY[i] * step + candidate.edgeX[i];
+        }
+    }
+
+    void Matcher::matchTemplateMajor(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches) {
+        const auto N = criteria->featurePointsCount;
+        const auto minThreshold = static_cast<int>(criteria->featurePointsCount * criteria->matchFactor);
+        const auto spreadStep = static_cast<int>(scene.spreadNormals.step);
+
+        // Group (candidate, window) pairs by candidates, so features of each template stay in cache across its windows
+        std::vector<std::pair<uint, int>> pairs;
+        std::vector<size_t> groups;
+        groupCandidates(windows, pairs, groups);
+
+        #pragma omp parallel shared(scene, store, windows, matches, pairs, groups) firstprivate(N, minThreshold, spreadStep)
+        {
+            std::vector<cv::Point> offsetStable(N);
+            std::vector<int> linStable(N), linEdge(N);
+            std::vector<Match> localMatches; // Matches found by current thread, merged into matches at the end
+            CascadeStats localStats;
+
+            #pragma omp for schedule(dynamic)
+            for (int g = 0; g < static_cast<int>(groups.size()) - 1; ++g) {
+                const uint handle = pairs[groups[g]].first;
+                const TemplateFeatures &candidate = store[handle];
+
+                // Linear offsets of feature points relative to window, computed once for all windows
+                linearOffsets(candidate, spreadStep, linStable.data(), linEdge.data());
+
+                for (size_t p = groups[g]; p < groups[g + 1]; ++p) {
+                    Window &window = windows[pairs[p].second];
+                    const cv::Point winTl = window.tl();
+                    const cv::Point winCenter(winTl.x + window.width / 2, winTl.y + window.height / 2);
+                    float score = 0;
+
+                    if (!testCandidate(scene, candidate, linStable.data(), linEdge.data(), winTl, winCenter, minThreshold, offsetStable,
+                                       score, localStats)) continue;
+
+                    // Push template that passed all tests to matches array
+                    cv::Rect matchBB = cv::Rect(winTl.x, winTl.y, candidate.width, candidate.height);
+                    localMatches.emplace_back(store.tpl(handle), matchBB, scene.scale, score * (candidate.objArea / scene.scale));
+                }
+            }
+
+            // Merge results of current thread
+            #pragma omp critical
+            {
+                matches.insert(matches.end(), localMatches.begin(), localMatches.end());
+                stats += localStats;
+            }
+        }
+    }
+
+    void Matcher::matchLinearized(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches) {
+        // Checks
+        assert(!scene.linearNormals.empty());
+        assert(!scene.linearGradients.empty());
+        CV_Assert(criteria->featurePointsCount < 256);
+
+        const auto N = criteria->featurePointsCount;
+        const auto minThreshold = static_cast<int>(criteria->featurePointsCount * criteria->matchFactor);
+        const int T = criteria->windowStep;
+        const int gridW = scene.spreadNormals.cols / T;
+        const int area = scene.linearNormals[0].cols;
+
+        // Group (candidate, window) pairs by candidates, so each template is evaluated over all windows at once
+        std::vector<std::pair<uint, int>> pairs;
+        std::vector<size_t> groups;
+        groupCandidates(windows, pairs, groups);
+
+        #pragma omp parallel shared(scene, store, windows, matches, pairs, groups) firstprivate(N, minThreshold, T, gridW, area)
+        {
+            std::vector<uchar> accNormals(area), accGradients(area); // Tests II and III scores of all windows on the grid
+            std::vector<cv::Point> offsetStable(N);
+            std::vector<Match> localMatches; // Matches found by current thread, merged into matches at the end
+            CascadeStats localStats;
+
+            #pragma omp for schedule(dynamic)
+            for (int g = 0; g < static_cast<int>(groups.size()) - 1; ++g) {
+                const uint handle = pairs[groups[g]].first;
+                const TemplateFeatures &candidate = store[handle];
+
+                // Only accumulate responses in range of grid indices, covered by windows containing this candidate
+                int lo = area - 1, hi = 0;
+                for (size_t p = groups[g]; p < groups[g + 1]; ++p) {
+                    const Window &window = windows[pairs[p].second];
+                    assert(window.x % T == 0 && window.y % T == 0);
+
+                    const int idx = (window.y / T) * gridW + window.x / T;
+                    lo = std::min(lo, idx);
+                    hi = std::max(hi, idx);
+                }
+
+                // Test II and III for all windows at once
+                accumulateResponses(scene.linearNormals, candidate.stableX, candidate.stableY, candidate.normals, gridW, lo, hi, accNormals);
+                accumulateResponses(scene.linearGradients, candidate.edgeX, candidate.edgeY, candidate.gradients, gridW, lo, hi, accGradients);
+
+                for (size_t p = groups[g]; p < groups[g + 1]; ++p) {
+                    Window &window = windows[pairs[p].second];
+                    const cv::Point winTl = window.tl();
+                    const cv::Point winCenter(winTl.x + window.width / 2, winTl.y + window.height / 2);
+                    const int idx = (window.y / T) * gridW + window.x / T;
+
+                    // Scores for each test
+                    float sII = accNormals[idx], sIII = accGradients[idx], sIV = 0, sV = 0;
+
+                    // TEST I
+                    localStats.candidates++;
+                    if (!testObjectSize(scene.srcDepth, winCenter, candidate.avgDepth)) continue;
+                    localStats.passed[0]++;
+
+                    // Test II and III (all feature points were accumulated)
+                    localStats.evaluated[0]++;
+                    localStats.points[0] += N;
+                    if (sII < minThreshold) continue;
+                    localStats.passed[1]++;
+
+                    localStats.evaluated[1]++;
+                    localStats.points[1] += N;
+                    if (sIII < minThreshold) continue;
+                    localStats.passed[2]++;
+
+                    // Offset stable feature points to coordinates of current window
+                    for (int i = 0; i < N; ++i) {
+                        offsetStable[i] = cv::Point(candidate.stableX[i] + winTl.x, candidate.stableY[i] + winTl.y);
+                    }
+
+                    // Test IV and V
+                    if (!testDepthAndColor(scene, candidate, offsetStable, minThreshold, sIV, sV, localStats)) continue;
+
+                    // Push template that passed all tests to matches array
+                    float score = (sII / N) + (sIII / N) + (sIV / N) + (sV / N);
+                    cv::Rect matchBB = cv::Rect(winTl.x, winTl.y, candidate.width, candidate.height);
+                    localMatches.emplace_back(store.tpl(handle), matchBB, scene.scale, score * (candidate.objArea / scene.scale));
+                }
+            }
+
+            // Merge results of current thread
+            #pragma omp critical
+            {
+                matches.insert(matches.end(), localMatches.begin(), localMatches.end());
+                stats += localStats;
+            }
+        }
+    }
+
+    void Matcher::match(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches) {
         // Checks
         assert(!scene.srcDepth.empty());
         assert(!scene.srcNormals.empty());
@@ -198,109 +605,121 @@ namespace tless {
         assert(scene.srcHue.type() == CV_8UC1);
         assert(scene.srcDepth.type() == CV_16U);
         assert(scene.srcNormals.type() == CV_8UC1);
+        assert(scene.spreadNormals.step == scene.spreadGradients.step);
+        assert(!scene.spreadMinDepth.empty());
+        assert(!scene.spreadMaxDepth.empty());
+        assert(!scene.spreadHue.empty());
         assert(!windows.empty());
 
+#ifndef VIZ_MATCHING
+        // Evaluate tests II and III using linearized response maps
+        if (criteria->linearMatching) {
+            matchLinearized(scene, store, windows, matches);
+            return;
+        }
+
+        // Evaluate candidates grouped by templates
+        if (criteria->templateMajor) {
+            matchTemplateMajor(scene, store, windows, matches);
+            return;
+        }
+#endif
+
         // Init vizaulizer
         Visualizer viz(criteria);
 
         // Min threshold of matched feature points
         const auto N = criteria->featurePointsCount;
         const auto minThreshold = static_cast<int>(criteria->featurePointsCount * criteria->matchFactor);
+        const auto spreadStep = static_cast<int>(scene.spreadNormals.step);
 
-#ifndef VIZ_MATCHING
-        #pragma omp parallel for shared(scene, windows, matches) firstprivate(N, minThreshold)
-#endif
-        for (int l = 0; l < windows.size(); l++) {
-            std::vector<cv::Point> offsetStable(N), offsetEdge(N); // Array of feature points shifted to currently processed window
-            const cv::Point winTl = windows[l].tl();
-            const cv::Point winCenter(winTl.x + windows[l].width / 2, winTl.y + windows[l].height / 2);
-            float diameter;
-            int depthMedian;
-
-            for (int c = 0; c < windows[l].candidates.size(); ++c) {
-                Template *candidate = windows[l].candidates[c];
-                assert(candidate != nullptr);
-
-                // Offset all feature points to coordinates of current window
-                for (int i = 0; i < N; ++i) {
-                    offsetStable[i] = candidate->stablePoints[i] + winTl;
-                    offsetEdge[i] = candidate->edgePoints[i] + winTl;
-                }
-
-#ifdef VIZ_MATCHING
-                // Accumulate depth differences
-                depthMedian = depthDiffMedian(scene.srcDepth, offsetStable, candidate->features.depths);
-                diameter = candidate->diameter * criteria->info.depthScaleFactor * criteria->depthK;
-
-                // Vizualization
-                std::vector<std::pair<cv::Point, int>> vsI, vsII, vsIII, vsIV, vsV;
-
-                // Object size test
-                vsI.emplace_back(cv::Point(candidate->objBB.x + candidate->objBB.width / 2, candidate->objBB.y + candidate->objBB.height / 2),
-                                 testObjectSize(scene.srcDepth, winCenter, candidate->features.avgDepth));
-
-                // Save validation for all points
-                for (uint i = 0; i < N; i++) {
-                    vsII.emplace_back(candidate->stablePoints[i], (scene.spreadNormals.at<uchar>(offsetStable[i]) & candidate->features.normals[i]) > 0);
-                    vsIII.emplace_back(candidate->edgePoints[i], (scene.spreadGradients.at<uchar>(offsetEdge[i]) & candidate->features.gradients[i]) > 0);
-                    vsIV.emplace_back(candidate->stablePoints[i], testDepth(scene.srcDepth, offsetStable[i], candidate->features.depths[i], depthMedian, diameter));
-                    vsV.emplace_back(candidate->stablePoints[i], testColor(scene.srcHue, offsetStable[i], candidate->features.hue[i]));
-                }
+        // Window processing order, windows array itself is left untouched
+        std::vector<int> order(windows.size());
+        std::iota(order.begin(), order.end(), 0);
 
-                // Push each score to scores vector
-                std::vector<std::vector<std::pair<cv::Point, int>>> scores = {vsI, vsII, vsIII, vsIV, vsV};
+#ifndef VIZ_MATCHING
+        // Process windows with most candidates first, so there are no heavy windows left at the end of dynamic schedule
+        std::stable_sort(order.begin(), order.end(), [&windows](int a, int b) {
+            return windows[a] > windows[b];
+        });
 
-                // Visualize matching
-                if (viz.matching(scene, *candidate, windows, l, c, scores, criteria->patchOffset, minThreshold)) {
-                    break;
-                }
+        #pragma omp parallel shared(scene, store, windows, matches, order) firstprivate(N, minThreshold, spreadStep)
 #endif
-                // Scores for each test
-                float sII = 0, sIII = 0, sIV = 0, sV = 0;
+        {
+            std::vector<Match> localMatches; // Matches found by current thread, merged into matches at the end
+            CascadeStats localStats;
+            std::vector<cv::Point> offsetStable(N); // Array of stable feature points shifted to currently processed window
+            std::vector<int> linStable(N), linEdge(N); // Linear offsets of feature points into spread feature images relative to window
 
-                // TEST I
-                if (!testObjectSize(scene.srcDepth, winCenter, candidate->features.avgDepth)) continue;
+#ifndef VIZ_MATCHING
+            #pragma omp for schedule(dynamic)
+#endif
+            for (int o = 0; o < static_cast<int>(order.size()); o++) {
+                const int l = order[o];
+                const cv::Point winTl = windows[l].tl();
+                const cv::Point winCenter(winTl.x + windows[l].width / 2, winTl.y + windows[l].height / 2);
 
-                // Test II
-                for (uint i = 0; i < N; i++) {
-                    sII += (scene.spreadNormals.at<uchar>(offsetStable[i]) & candidate->features.normals[i]) > 0;
-                }
+                for (int c = 0; c < windows[l].candidates.size(); ++c) {
+                    const uint handle = windows[l].candidates[c];
+                    const TemplateFeatures &candidate = store[handle];
 
-                if (sII < minThreshold) continue;
+                    // Offset all feature points relative to the window
+                    linearOffsets(candidate, spreadStep, linStable.data(), linEdge.data());
 
-                // Test III
-                for (uint i = 0; i < N; i++) {
-                    sIII += (scene.spreadGradients.at<uchar>(offsetEdge[i]) & candidate->features.gradients[i]) > 0;
-                }
+#ifdef VIZ_MATCHING
+                    Template *tpl = store.tpl(handle);
+                    std::vector<cv::Point> offsetEdge(N);
 
-                if (sIII < minThreshold) continue;
+                    for (uint i = 0; i < N; ++i) {
+                        offsetStable[i] = cv::Point(candidate.stableX[i] + winTl.x, candidate.stableY[i] + winTl.y);
+                        offsetEdge[i] = cv::Point(candidate.edgeX[i] + winTl.x, candidate.edgeY[i] + winTl.y);
+                    }
 
-                // Test IV
-                // Calculate depth median accross differences
-                depthMedian = depthDiffMedian(scene.srcDepth, offsetStable, candidate->features.depths);
-                diameter = candidate->diameter * criteria->info.depthScaleFactor * criteria->depthK;
+                    // Accumulate depth differences
+                    int depthMedian = depthDiffMedian(scene.srcDepth, offsetStable, candidate.depths);
+                    float diameter = candidate.diameter * criteria->info.depthScaleFactor * criteria->depthK;
 
-                // Perform depth test over stable points
-                for (uint i = 0; i < N; i++) {
-                    sIV += testDepth(scene.srcDepth, offsetStable[i], candidate->features.depths[i], depthMedian, diameter);
-                }
+                    // Vizualization
+                    std::vector<std::pair<cv::Point, int>> vsI, vsII, vsIII, vsIV, vsV;
 
-                if (sIV < minThreshold) continue;
+                    // Object size test
+                    vsI.emplace_back(cv::Point(tpl->objBB.x + tpl->objBB.width / 2, tpl->objBB.y + tpl->objBB.height / 2),
+                                     testObjectSize(scene.srcDepth, winCenter, candidate.avgDepth));
 
-                // Test V
-                for (uint i = 0; i < N; i++) {
-                    sV += testColor(scene.srcHue, offsetStable[i], candidate->features.hue[i]);
-                }
+                    // Save validation for all points
+                    for (uint i = 0; i < N; i++) {
+                        vsII.emplace_back(tpl->stablePoints[i], (scene.spreadNormals.at<uchar>(offsetStable[i]) & candidate.normals[i]) > 0);
+                        vsIII.emplace_back(tpl->edgePoints[i], (scene.spreadGradients.at<uchar>(offsetEdge[i]) & candidate.gradients[i]) > 0);
+                        vsIV.emplace_back(tpl->stablePoints[i], testDepth(scene, offsetStable[i], candidate.depths[i], depthMedian, diameter));
+                        vsV.emplace_back(tpl->stablePoints[i], testColor(scene, offsetStable[i], candidate.hue[i]));
+                    }
 
-                if (sV < minThreshold) continue;
+                    // Push each score to scores vector
+                    std::vector<std::vector<std::pair<cv::Point, int>>> scores = {vsI, vsII, vsIII, vsIV, vsV};
 
-                // Push template that passed all tests to matches array
-                float score = (sII / N) + (sIII / N) + (sIV / N) + (sV / N);
-                cv::Rect matchBB = cv::Rect(windows[l].tl().x, windows[l].tl().y, candidate->objBB.width, candidate->objBB.height);
+                    // Visualize matching
+                    if (viz.matching(scene, *tpl, windows, l, c, scores, criteria->patchOffset, minThreshold)) {
+                        break;
+                    }
+#endif
+                    // Tests I - V
+                    float score = 0;
+                    if (!testCandidate(scene, candidate, linStable.data(), linEdge.data(), winTl, winCenter, minThreshold, offsetStable,
+                                       score, localStats)) continue;
+
+                    // Push template that passed all tests to matches array
+                    cv::Rect matchBB = cv::Rect(winTl.x, winTl.y, candidate.width, candidate.height);
+                    localMatches.emplace_back(store.tpl(handle), matchBB, scene.scale, score * (candidate.objArea / scene.scale));
+                }
+            }
 
-                // This section is almost never executed at the same time, as the tests do have non-uniform results, also most of the windows never passes the fifth test
-                #pragma omp critical
-                matches.emplace_back(candidate, matchBB, scene.scale, score * (candidate->objArea / scene.scale));
+            // Merge results of current thread
+#ifndef VIZ_MATCHING
+            #pragma omp critical
+#endif
+            {
+                matches.insert(matches.end(), localMatches.begin(), localMatches.end());
+                stats += localStats;
             }
         }
     }
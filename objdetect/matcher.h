@@ -8,6 +8,8 @@
 #include "../core/match.h"
 #include "../core/classifier_criteria.h"
 #include "../core/scene.h"
+#include "../core/feature_store.h"
+#include "../core/cascade_stats.h"
 
 namespace tless {
     /**
@@ -16,6 +18,8 @@ namespace tless {
     class Matcher {
     private:
         cv::Ptr<ClassifierCriteria> criteria;
+        uint64 hueSureBins[256]; //!< Hue bins (HUE_BIN_WIDTH), where all values are within criteria.maxHueDiff from given hue
+        uint64 hueMaybeBins[256]; //!< Hue bins (HUE_BIN_WIDTH), where at least one value is within criteria.maxHueDiff from given hue
 
         /**
          * @brief Selects scattered feature points, that are somehow uniformly distributed over the template.
@@ -30,12 +34,14 @@ namespace tless {
         /**
          * @brief Accumulates list of depth difference between scene and template across all stable points and computes median of depth differences.
          *
+         * Points with invalid scene depth (or out of the scene) are skipped, differences are collected in stack buffer.
+         *
          * @param[in] sceneDepth   Input scene 16-bit depth image
          * @param[in] stablePoints List of precomputed feature stable points shifted to current window
          * @param[in] tplDepths    Precomputed template depths at stable points
          * @return                 Median value of depth differences across all stable points
          */
-        int depthDiffMedian(const cv::Mat &sceneDepth, const std::vector<cv::Point> &stablePoints, const std::vector<ushort> &tplDepths);
+        int depthDiffMedian(const cv::Mat &sceneDepth, const std::vector<cv::Point> &stablePoints, const ushort *tplDepths);
 
         /**
          * @brief Test I, perfmors check whether scene center depth lies within interval defined using avg template depth.
@@ -50,27 +56,142 @@ namespace tless {
         /**
          * @brief Test IV, performs a depth test to se whether object depth differences are lower than median.
          *
-         * @param[in] sceneDepth  Input scene 16-bit depth image
-         * @param[in] diameter    Pre-calculated object diameter (candidate->diameter * criteria->info.depthScaleFactor * criteria->depthK)
-         * @param[in] depthMedian Depth median computed from depth differences using depthDiffMedian() function
-         * @param[in] depth       Currently processed template depth, sampled at given stable feature point
+         * Depth extremes of the patch (scene.spreadMinDepth, scene.spreadMaxDepth) are checked first, the patch
+         * itself is scanned only when the extremes lie on both sides of the expected depth and neither of them matches.
+         *
+         * @param[in] scene       Current scene in image scale pyramid
          * @param[in] stable      Currently processed stable feature point shifted to current window
+         * @param[in] depth       Currently processed template depth, sampled at given stable feature point
+         * @param[in] depthMedian Depth median computed from depth differences using depthDiffMedian() function
+         * @param[in] diameter    Pre-calculated object diameter (candidate->diameter * criteria->info.depthScaleFactor * criteria->depthK)
          * @return                1 whether there was a match within small patch around stable point (-patchOffset <-> patchOffset), otherwise 0
          */
-        inline int testDepth(const cv::Mat &sceneDepth, const cv::Point &stable, ushort depth, int depthMedian, float diameter);
+        inline int testDepth(const ScenePyramid &scene, const cv::Point &stable, ushort depth, int depthMedian, float diameter);
 
         /**
          * @brief Test V, performs check whether object hue of HSV color space correspond to scene hue value (both are normalized).
          *
-         * @param[in] sceneHSV Input 8-bit normalized scene hue values
-         * @param[in] stable   Currently processed stable feature point shifted to current window
-         * @param[in] hue      Currently processed hue, sampled at given stable feature point
-         * @return             1 whether absolute differece of hue values is < criteria->maxHueDiff, otherwise 0
+         * Spread hue bins of the patch (scene.spreadHue) are checked first against bins that surely match (hueSureBins) and bins
+         * that can match (hueMaybeBins), the patch itself is scanned only when the answer depends on exact hue values.
+         *
+         * @param[in] scene  Current scene in image scale pyramid
+         * @param[in] stable Currently processed stable feature point shifted to current window
+         * @param[in] hue    Currently processed hue, sampled at given stable feature point
+         * @return           1 whether absolute differece of hue values is < criteria->maxHueDiff, otherwise 0
          */
-        inline int testColor(const cv::Mat &sceneHue, const cv::Point &stable, uchar hue);
+        inline int testColor(const ScenePyramid &scene, const cv::Point &stable, uchar hue);
+
+        /**
+         * @brief Performs tests IV (depth) and V (color) over all stable feature points shifted to current window.
+         *
+         * @param[in]  scene        Current scene in image scale pyramid
+         * @param[in]  candidate    Features of currently processed template candidate
+         * @param[in]  offsetStable Stable feature points shifted to current window
+         * @param[in]  minThreshold Min number of feature points that have to match in each test
+         * @param[out] sIV          Number of feature points matched in depth test
+         * @param[out] sV           Number of feature points matched in color test
+         * @param[out] stats        Cascade counters to update
+         * @return                  True whether candidate passed both tests
+         */
+        bool testDepthAndColor(const ScenePyramid &scene, const TemplateFeatures &candidate, const std::vector<cv::Point> &offsetStable,
+                               int minThreshold, float &sIV, float &sV, CascadeStats &stats);
+
+        /**
+         * @brief Groups (candidate, window) pairs of all windows by template candidates.
+         *
+         * @param[in]  windows Windows with candidates filtered in hasher verification
+         * @param[out] pairs   Pairs of (template handle, window index) sorted by template handles
+         * @param[out] groups  Start index of each template group in pairs array, last element is pairs.size()
+         */
+        void groupCandidates(const std::vector<Window> &windows, std::vector<std::pair<uint, int>> &pairs, std::vector<size_t> &groups);
+
+        /**
+         * @brief Computes linear offsets (y * step + x) of template feature points relative to the top left corner of the window.
+         *
+         * @param[in]  candidate Features of template candidate
+         * @param[in]  step      Row step of spread feature images
+         * @param[out] linStable Linear offsets of stable feature points
+         * @param[out] linEdge   Linear offsets of edge feature points
+         */
+        void linearOffsets(const TemplateFeatures &candidate, int step, int *linStable, int *linEdge);
+
+        /**
+         * @brief Performs tests I - V for one template candidate in one window.
+         *
+         * @param[in]  scene        Current scene in image scale pyramid
+         * @param[in]  candidate    Features of currently processed template candidate
+         * @param[in]  linStable    Linear offsets of stable feature points relative to window (see linearOffsets())
+         * @param[in]  linEdge      Linear offsets of edge feature points relative to window
+         * @param[in]  winTl        Top left corner of currently processed window
+         * @param[in]  winCenter    Center of currently processed window
+         * @param[in]  minThreshold Min number of feature points that have to match in each test
+         * @param[out] offsetStable Buffer for stable feature points shifted to current window (size of criteria.featurePointsCount)
+         * @param[out] score        Final score of the candidate, fraction of sum of matched points in tests II - V
+         * @param[out] stats        Cascade counters to update
+         * @return                  True whether candidate passed all tests
+         */
+        bool testCandidate(const ScenePyramid &scene, const TemplateFeatures &candidate, const int *linStable, const int *linEdge,
+                           const cv::Point &winTl, const cv::Point &winCenter, int minThreshold, std::vector<cv::Point> &offsetStable,
+                           float &score, CascadeStats &stats);
+
+        /**
+         * @brief Applies template matching in template-major order (criteria.templateMajor).
+         *
+         * (window, candidate) pairs are grouped by candidates and each template is evaluated against all windows
+         * that voted for it, so it's features are loaded only once and stay in cache. Produces same matches as match().
+         *
+         * @param[in]  scene   Current scene in image scale pyramid
+         * @param[in]  store   Feature store of all templates, window candidates are handles into this store
+         * @param[in]  windows Windows array that passed objectness detection with candidates filtered in hasher verification
+         * @param[out] matches Final array foound matches
+         */
+        void matchTemplateMajor(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches);
+
+        /**
+         * @brief Accumulates linearized responses of all feature points of one template for windows on the sliding window grid.
+         *
+         * Windows whose feature point falls outside of the grid (right or bottom of the scene) get no response for it.
+         *
+         * @param[in]  maps     Linearized response maps for each quantized orientation (ScenePyramid::linearNormals or linearGradients)
+         * @param[in]  xs       X coordinates of template feature points (stable points for normals, edge points for gradients)
+         * @param[in]  ys       Y coordinates of template feature points
+         * @param[in]  features Quantized template features at given feature points
+         * @param[in]  gridW    Number of window positions in one row of the sliding window grid
+         * @param[in]  lo       First grid index (y / windowStep * gridW + x / windowStep) to accumulate responses for
+         * @param[in]  hi       Last grid index to accumulate responses for
+         * @param[out] acc      Number of matched feature points for each grid index in <lo, hi>
+         */
+        void accumulateResponses(const std::vector<cv::Mat> &maps, const short *xs, const short *ys, const uchar *features,
+                                 int gridW, int lo, int hi, std::vector<uchar> &acc);
+
+        /**
+         * @brief Applies template matching using linearized response maps (criteria.linearMatching).
+         *
+         * (window, candidate) pairs are grouped by candidates, for each template tests II and III are then computed
+         * for all windows at once as contiguous additions of linearized response maps, one per feature point. This
+         * way the cost of tests II and III scales with templates * feature points instead of windows * candidates * points.
+         * Remaining tests are computed per window, same as in match(). Windows have to lie on criteria.windowStep grid.
+         *
+         * @param[in]  scene   Current scene in image scale pyramid (with computed linearized response maps)
+         * @param[in]  store   Feature store of all templates, window candidates are handles into this store
+         * @param[in]  windows Windows array that passed objectness detection with candidates filtered in hasher verification
+         * @param[out] matches Final array foound matches
+         */
+        void matchLinearized(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches);
 
     public:
-        Matcher(cv::Ptr<ClassifierCriteria> criteria) : criteria(criteria) {}
+        CascadeStats stats; //!< Cascade counters accumulated across all match() calls, until reset
+
+        Matcher(cv::Ptr<ClassifierCriteria> criteria) : criteria(criteria) {
+            initHueBins();
+        }
+
+        /**
+         * @brief Computes hueSureBins and hueMaybeBins for each hue value based on criteria.maxHueDiff.
+         *
+         * Tables are built in constructor and in train(), call it again whenever criteria.maxHueDiff changes (e.g. after load).
+         */
+        void initHueBins();
 
         /**
          * @brief Applies template matching for each template in candidate list of each window.
@@ -79,15 +200,17 @@ namespace tless {
          * depth and color between template trained features and scene features on trained feature points. Feature point is matched
          * if there's a match inside small area around feature point (5x5) to compensate sliding window step. Each test is computed
          * in order of it's complexity, if candidate doesn't match at least [criteria.matchFactor] of feature points in each, no further
-         * tests are computed and we continue with other candidates. Candidate that passes all tests gets final score of a fraction of
+         * tests are computed and we continue with other candidates. Each test stops as soon as the threshold can't be reached by
+         * remaining feature points (or once it's reached, when criteria.earlyAccept is set). Candidate that passes all tests gets final score of a fraction of
          * sum of matched points. After all windows have been tested, non-maxima suppression is applied to all matches to filter out the
          * best candidates which are than retained in the final matches vector.
          *
          * @param[in]  scene   Current scene in image scale pyramid
+         * @param[in]  store   Feature store of all templates, window candidates are handles into this store
          * @param[in]  windows Windows array that passed objectness detection test with candidates filtered in hasher verification
          * @param[out] matches Final array foound matches
          */
-        void match(ScenePyramid &scene, std::vector<Window> &windows, std::vector<Match> &matches);
+        void match(ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, std::vector<Match> &matches);
 
         /**
          * @brief Generates feature points and extract features for each template.
@@ -103,6 +226,17 @@ namespace tless {
          * @param[in]     minEdgeMag   Minimum edge magnitude of an extracted edgePoint
          */
         void train(std::vector<Template> &templates, uchar minStableVal = 40, uchar minEdgeMag = 40);
+
+        /**
+         * @brief Reorders feature points of each template by rarity of their quantized features (criteria.sortFeaturePoints).
+         *
+         * Frequency of each quantized normal and gradient is counted across all templates, stable points are then sorted
+         * ascending by frequency of their normals and edge points by frequency of their gradients. Rare features are less
+         * likely to match in the scene, so early termination in tests II and III rejects most candidates sooner.
+         *
+         * @param[in,out] templates Array of templates with extracted features
+         */
+        void sortFeaturePoints(std::vector<Template> &templates);
     };
 }
 
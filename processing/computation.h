@@ -42,29 +42,47 @@ namespace tless {
     }
 
     /**
-     * @brief Returns median value of input array.
+     * @brief Returns median value of values in range <first, last), using linear-time selection (std::nth_element).
+     *
+     * Values in the range are partially reordered, no memory is allocated so it can be used on stack buffers.
      *
-     * @tparam    T      Values data type
-     * @param[in] values Array of input values
-     * @return           Median of input array
+     * @tparam        T     Values data type
+     * @param[in,out] first Pointer to the first value
+     * @param[in,out] last  Pointer past the last value
+     * @return              Median of values in range (average of two middle values for even count), 0 for empty range
      */
     template<typename T>
-    T median(std::vector<T> &values) {
-        T median;
+    T median(T *first, T *last) {
+        const auto size = static_cast<size_t>(last - first);
 
-        // Sort values
-        std::sort(values.begin(), values.end());
-        const size_t size = values.size();
+        if (size == 0) {
+            return T(0);
+        }
+
+        // Select middle element, all elements before it are lower or equal
+        T *middle = first + size / 2;
+        std::nth_element(first, middle, last);
+        T median = *middle;
 
         if (size % 2 == 0) {
-            median = (values[size / 2 - 1] + values[size / 2]) / 2;
-        } else {
-            median = values[size / 2];
+            median = (*std::max_element(first, middle) + median) / 2;
         }
 
         return median;
     }
 
+    /**
+     * @brief Returns median value of input array.
+     *
+     * @tparam        T      Values data type
+     * @param[in,out] values Array of input values (values are partially reordered)
+     * @return               Median of input array
+     */
+    template<typename T>
+    T median(std::vector<T> &values) {
+        return median<T>(values.data(), values.data() + values.size());
+    }
+
     /**
      * @brief Removes elements at indexes to_remove from the input array.
      *
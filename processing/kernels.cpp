@@ -0,0 +1,897 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TLESS_X86
+#endif
+
+namespace tless {
+    /**
+     * Detects the best instruction set supported by current CPU.
+     *
+     * @return Best supported SIMD level
+     */
+    static SimdLevel detectSimdLevel() {
+#ifdef TLESS_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            return SimdLevel::SSE;
+        }
+#endif
+
+        return SimdLevel::SCALAR;
+    }
+
+    static const SimdLevel supportedLevel = detectSimdLevel();
+    static SimdLevel activeLevel = supportedLevel;
+
+    SimdLevel simdLevel() {
+        return activeLevel;
+    }
+
+    void setSimdLevel(SimdLevel level) {
+        activeLevel = std::min(level, supportedLevel);
+    }
+
+    static int matchFeaturesScalar(const uchar *src, const int *offsets, const uchar *features, int N, int minScore, int maxScore, int &i, int score) {
+        for (; i < N && score + (N - i) >= minScore && score < maxScore; ++i) {
+            score += (src[offsets[i]] & features[i]) > 0;
+        }
+
+        return score;
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("sse4.2,popcnt")))
+    static int matchFeaturesSSE(const uchar *src, const int *offsets, const uchar *features, int N, int minScore, int maxScore, int &i) {
+        alignas(16) uchar gathered[16];
+        const __m128i zero = _mm_setzero_si128();
+        int score = 0;
+
+        for (; i + 16 <= N && score + (N - i) >= minScore && score < maxScore; i += 16) {
+            // SSE has no gather, load scene bytes one by one
+            for (int j = 0; j < 16; ++j) {
+                gathered[j] = src[offsets[i + j]];
+            }
+
+            // Set bits for features that have no bits in common with the scene
+            __m128i anded = _mm_and_si128(_mm_load_si128(reinterpret_cast<const __m128i *>(gathered)),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i *>(features + i)));
+            auto mask = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(anded, zero)));
+            score += 16 - _mm_popcnt_u32(mask);
+        }
+
+        return matchFeaturesScalar(src, offsets, features, N, minScore, maxScore, i, score);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static int matchFeaturesAVX2(const uchar *src, const int *offsets, const uchar *features, int N, int minScore, int maxScore, int &i) {
+        const __m256i zero = _mm256_setzero_si256();
+        const auto *base = reinterpret_cast<const int *>(src);
+        int score = 0;
+
+        for (; i + 8 <= N && score + (N - i) >= minScore && score < maxScore; i += 8) {
+            // Gather 32-bit words starting at each offset, only the lowest byte is relevant
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(offsets + i));
+            __m256i scene = _mm256_i32gather_epi32(base, idx, 1);
+
+            // Zero extend 8 template features to 32-bit lanes, this also masks out upper bytes of scene words
+            __m256i tpl = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(features + i)));
+            __m256i anded = _mm256_and_si256(scene, tpl);
+            auto mask = static_cast<uint>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(anded, zero))));
+            score += 8 - _mm_popcnt_u32(mask);
+        }
+
+        return matchFeaturesScalar(src, offsets, features, N, minScore, maxScore, i, score);
+    }
+#endif
+
+    static void addResponsesScalar(uchar *dst, const uchar *src, int n) {
+        for (int i = 0; i < n; ++i) {
+            int sum = dst[i] + src[i];
+            dst[i] = static_cast<uchar>(sum > 255 ? 255 : sum);
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("sse4.2")))
+    static void addResponsesSSE(uchar *dst, const uchar *src, int n) {
+        int i = 0;
+
+        for (; i + 16 <= n; i += 16) {
+            __m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+            __m128i resp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_adds_epu8(acc, resp));
+        }
+
+        addResponsesScalar(dst + i, src + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void addResponsesAVX2(uchar *dst, const uchar *src, int n) {
+        int i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+            __m256i resp = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_adds_epu8(acc, resp));
+        }
+
+        addResponsesScalar(dst + i, src + i, n - i);
+    }
+#endif
+
+    static void orBytesScalar(uchar *dst, const uchar *src, int n) {
+        for (int i = 0; i < n; ++i) {
+            dst[i] |= src[i];
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("sse4.2")))
+    static void orBytesSSE(uchar *dst, const uchar *src, int n) {
+        int i = 0;
+
+        for (; i + 16 <= n; i += 16) {
+            __m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+            __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(acc, val));
+        }
+
+        orBytesScalar(dst + i, src + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void orBytesAVX2(uchar *dst, const uchar *src, int n) {
+        int i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+            __m256i val = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(acc, val));
+        }
+
+        orBytesScalar(dst + i, src + i, n - i);
+    }
+#endif
+
+    static void addBitSlicedScalar(uint64 *planes, int stride, int count, const uint64 *bits, uint64 *any, int n) {
+        for (int i = 0; i < n; ++i) {
+            uint64 carry = bits[i];
+            any[i] |= carry;
+
+            for (int b = 0; b < count && carry != 0; ++b) {
+                uint64 &plane = planes[b * stride + i];
+                uint64 next = plane & carry;
+                plane ^= carry;
+                carry = next;
+            }
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("sse4.2")))
+    static void addBitSlicedSSE(uint64 *planes, int stride, int count, const uint64 *bits, uint64 *any, int n) {
+        int i = 0;
+
+        for (; i + 2 <= n; i += 2) {
+            __m128i carry = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits + i));
+            auto *pAny = reinterpret_cast<__m128i *>(any + i);
+            _mm_storeu_si128(pAny, _mm_or_si128(_mm_loadu_si128(pAny), carry));
+
+            for (int b = 0; b < count && !_mm_testz_si128(carry, carry); ++b) {
+                auto *pPlane = reinterpret_cast<__m128i *>(planes + b * stride + i);
+                __m128i plane = _mm_loadu_si128(pPlane);
+                _mm_storeu_si128(pPlane, _mm_xor_si128(plane, carry));
+                carry = _mm_and_si128(plane, carry);
+            }
+        }
+
+        addBitSlicedScalar(planes + i, stride, count, bits + i, any + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void addBitSlicedAVX2(uint64 *planes, int stride, int count, const uint64 *bits, uint64 *any, int n) {
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            __m256i carry = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits + i));
+            auto *pAny = reinterpret_cast<__m256i *>(any + i);
+            _mm256_storeu_si256(pAny, _mm256_or_si256(_mm256_loadu_si256(pAny), carry));
+
+            for (int b = 0; b < count && !_mm256_testz_si256(carry, carry); ++b) {
+                auto *pPlane = reinterpret_cast<__m256i *>(planes + b * stride + i);
+                __m256i plane = _mm256_loadu_si256(pPlane);
+                _mm256_storeu_si256(pPlane, _mm256_xor_si256(plane, carry));
+                carry = _mm256_and_si256(plane, carry);
+            }
+        }
+
+        addBitSlicedScalar(planes + i, stride, count, bits + i, any + i, n - i);
+    }
+#endif
+
+    void addBitSliced(uint64 *planes, int stride, int count, const uint64 *bits, uint64 *any, int n) {
+#ifdef TLESS_X86
+        switch (activeLevel) {
+            case SimdLevel::AVX2:
+                return addBitSlicedAVX2(planes, stride, count, bits, any, n);
+            case SimdLevel::SSE:
+                return addBitSlicedSSE(planes, stride, count, bits, any, n);
+            default:
+                break;
+        }
+#endif
+
+        addBitSlicedScalar(planes, stride, count, bits, any, n);
+    }
+
+    static void compareBitSlicedScalar(const uint64 *planes, int stride, int count, int value, const uint64 *any, uint64 *dst, int n) {
+        for (int i = 0; i < n; ++i) {
+            uint64 greater = 0, equal = any[i];
+
+            for (int b = count - 1; b >= 0 && equal != 0; --b) {
+                const uint64 plane = planes[b * stride + i];
+
+                if ((value >> b) & 1) {
+                    equal &= plane;
+                } else {
+                    greater |= equal & plane;
+                    equal &= ~plane;
+                }
+            }
+
+            dst[i] = greater | equal;
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("sse4.2")))
+    static void compareBitSlicedSSE(const uint64 *planes, int stride, int count, int value, const uint64 *any, uint64 *dst, int n) {
+        int i = 0;
+
+        for (; i + 2 <= n; i += 2) {
+            __m128i greater = _mm_setzero_si128();
+            __m128i equal = _mm_loadu_si128(reinterpret_cast<const __m128i *>(any + i));
+
+            for (int b = count - 1; b >= 0 && !_mm_testz_si128(equal, equal); --b) {
+                __m128i plane = _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes + b * stride + i));
+
+                if ((value >> b) & 1) {
+                    equal = _mm_and_si128(equal, plane);
+                } else {
+                    greater = _mm_or_si128(greater, _mm_and_si128(equal, plane));
+                    equal = _mm_andnot_si128(plane, equal);
+                }
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(greater, equal));
+        }
+
+        compareBitSlicedScalar(planes + i, stride, count, value, any + i, dst + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void compareBitSlicedAVX2(const uint64 *planes, int stride, int count, int value, const uint64 *any, uint64 *dst, int n) {
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            __m256i greater = _mm256_setzero_si256();
+            __m256i equal = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(any + i));
+
+            for (int b = count - 1; b >= 0 && !_mm256_testz_si256(equal, equal); --b) {
+                __m256i plane = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(planes + b * stride + i));
+
+                if ((value >> b) & 1) {
+                    equal = _mm256_and_si256(equal, plane);
+                } else {
+                    greater = _mm256_or_si256(greater, _mm256_and_si256(equal, plane));
+                    equal = _mm256_andnot_si256(plane, equal);
+                }
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(greater, equal));
+        }
+
+        compareBitSlicedScalar(planes + i, stride, count, value, any + i, dst + i, n - i);
+    }
+#endif
+
+    void compareBitSliced(const uint64 *planes, int stride, int count, int value, const uint64 *any, uint64 *dst, int n) {
+        // Counters can't reach values wider than planes
+        if (value >= (1 << count)) {
+            std::fill(dst, dst + n, uint64(0));
+            return;
+        }
+
+#ifdef TLESS_X86
+        switch (activeLevel) {
+            case SimdLevel::AVX2:
+                return compareBitSlicedAVX2(planes, stride, count, value, any, dst, n);
+            case SimdLevel::SSE:
+                return compareBitSlicedSSE(planes, stride, count, value, any, dst, n);
+            default:
+                break;
+        }
+#endif
+
+        compareBitSlicedScalar(planes, stride, count, value, any, dst, n);
+    }
+
+    void addResponses(uchar *dst, const uchar *src, int n) {
+#ifdef TLESS_X86
+        switch (activeLevel) {
+            case SimdLevel::AVX2:
+                return addResponsesAVX2(dst, src, n);
+            case SimdLevel::SSE:
+                return addResponsesSSE(dst, src, n);
+            default:
+                break;
+        }
+#endif
+
+        addResponsesScalar(dst, src, n);
+    }
+
+    void orBytes(uchar *dst, const uchar *src, int n) {
+#ifdef TLESS_X86
+        switch (activeLevel) {
+            case SimdLevel::AVX2:
+                return orBytesAVX2(dst, src, n);
+            case SimdLevel::SSE:
+                return orBytesSSE(dst, src, n);
+            default:
+                break;
+        }
+#endif
+
+        orBytesScalar(dst, src, n);
+    }
+
+    int matchFeatures(const uchar *src, const int *offsets, const uchar *features, int N, int minScore, int maxScore, int *evaluated) {
+        int i = 0, score;
+
+        switch (activeLevel) {
+#ifdef TLESS_X86
+            case SimdLevel::AVX2:
+                score = matchFeaturesAVX2(src, offsets, features, N, minScore, maxScore, i);
+                break;
+            case SimdLevel::SSE:
+                score = matchFeaturesSSE(src, offsets, features, N, minScore, maxScore, i);
+                break;
+#endif
+            default:
+                score = matchFeaturesScalar(src, offsets, features, N, minScore, maxScore, i, 0);
+                break;
+        }
+
+        if (evaluated != nullptr) {
+            *evaluated = i;
+        }
+
+        return score;
+    }
+
+    // Sine and cosine of gradient bin boundaries (36, 72, 108, 144 deg) in 1.15 fixed-point
+    static const int ORIENTATION_SIN[4] = {19261, 31164, 31164, 19261};
+    static const int ORIENTATION_COS[4] = {26510, 10126, -10126, -26510};
+    static const uchar ORIENTATION_BINS[16] = {1, 2, 4, 8, 16, 0};
+
+    static void quantizeGradientsScalar(const short *dx, const short *dy, uchar *dst, int n, int minMag2) {
+        for (int i = 0; i < n; ++i) {
+            int gx = dx[i], gy = dy[i];
+
+            if (gx * gx + gy * gy < minMag2) {
+                dst[i] = 0;
+                continue;
+            }
+
+            // Rotate gradient to upper half-plane [0, 180) deg
+            if (gy < 0 || (gy == 0 && gx < 0)) {
+                gx = -gx;
+                gy = -gy;
+            }
+
+            // Count bin boundaries the gradient lies past (sign of the cross product with each boundary)
+            int bin = 0;
+            for (int k = 0; k < 4; ++k) {
+                bin += (gy * ORIENTATION_COS[k] - gx * ORIENTATION_SIN[k] > 0) ? 1 : 0;
+            }
+
+            dst[i] = ORIENTATION_BINS[bin];
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("avx2")))
+    static void quantizeGradientsAVX2(const short *dx, const short *dy, uchar *dst, int n, int minMag2) {
+        const __m256i zero = _mm256_setzero_si256(), vMinMag2 = _mm256_set1_epi32(minMag2), invalid = _mm256_set1_epi32(5);
+        const __m128i bins = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ORIENTATION_BINS));
+        __m256i boundaries[4];
+        int i = 0;
+
+        // Pairs (-sin, cos) multiplied with interleaved (gx, gy) pairs by madd give the cross products
+        for (int k = 0; k < 4; ++k) {
+            boundaries[k] = _mm256_set1_epi32((ORIENTATION_COS[k] << 16) | (-ORIENTATION_SIN[k] & 0xFFFF));
+        }
+
+        for (; i + 16 <= n; i += 16) {
+            __m256i gx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dx + i));
+            __m256i gy = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dy + i));
+
+            // Rotate gradient to upper half-plane [0, 180) deg
+            __m256i neg = _mm256_or_si256(_mm256_cmpgt_epi16(zero, gy), _mm256_and_si256(_mm256_cmpeq_epi16(gy, zero), _mm256_cmpgt_epi16(zero, gx)));
+            gx = _mm256_sub_epi16(_mm256_xor_si256(gx, neg), neg);
+            gy = _mm256_sub_epi16(_mm256_xor_si256(gy, neg), neg);
+
+            __m256i pairs[2] = {_mm256_unpacklo_epi16(gx, gy), _mm256_unpackhi_epi16(gx, gy)};
+            __m256i codes[2];
+
+            for (int h = 0; h < 2; ++h) {
+                __m256i bin = zero;
+
+                for (int k = 0; k < 4; ++k) {
+                    bin = _mm256_sub_epi32(bin, _mm256_cmpgt_epi32(_mm256_madd_epi16(pairs[h], boundaries[k]), zero));
+                }
+
+                // Weak gradients use index of zero in bins table
+                __m256i weak = _mm256_cmpgt_epi32(vMinMag2, _mm256_madd_epi16(pairs[h], pairs[h]));
+                codes[h] = _mm256_blendv_epi8(bin, invalid, weak);
+            }
+
+            // Pack codes to bytes (unpack/pack round trip keeps pixel order) and look up bins
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(codes[0], codes[1]), zero);
+            __m128i idx = _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_shuffle_epi8(bins, idx));
+        }
+
+        quantizeGradientsScalar(dx + i, dy + i, dst + i, n - i, minMag2);
+    }
+#endif
+
+    void quantizeGradients(const short *dx, const short *dy, uchar *dst, int n, int minMag2) {
+#ifdef TLESS_X86
+        if (activeLevel == SimdLevel::AVX2) {
+            return quantizeGradientsAVX2(dx, dy, dst, n, minMag2);
+        }
+#endif
+
+        quantizeGradientsScalar(dx, dy, dst, n, minMag2);
+    }
+
+    // Fixed-point constants of OpenCV BGR2GRAY and BGR2HSV (8-bit) conversions
+    static const int GRAY_SHIFT = 14, GRAY_B = 1868, GRAY_G = 9617, GRAY_R = 4899;
+    static const int HSV_SHIFT = 12, HUE_RANGE = 180;
+
+    /**
+     * Returns table of hue divisors, (HUE_RANGE << HSV_SHIFT) / (6 * diff) for each max-min difference of BGR channels.
+     */
+    static const int *hueDivTable() {
+        struct Table {
+            int div[256];
+
+            Table() {
+                div[0] = 0;
+                for (int i = 1; i < 256; ++i) {
+                    div[i] = static_cast<int>(std::lrint((HUE_RANGE << HSV_SHIFT) / (6.0 * i)));
+                }
+            }
+        };
+
+        static const Table table;
+        return table.div;
+    }
+
+    void saturationLut(uchar saturation, int *lut) {
+        for (int v = 0; v < 256; ++v) {
+            // Same rounding as OpenCV, S = (diff * (255 << HSV_SHIFT) / V + 2^(HSV_SHIFT - 1)) >> HSV_SHIFT
+            const int sDiv = (v == 0) ? 0 : static_cast<int>(std::lrint((255 << HSV_SHIFT) / static_cast<double>(v)));
+            int diff = 0;
+
+            while (diff <= v && ((diff * sDiv + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT) < saturation) {
+                diff++;
+            }
+
+            lut[v] = (diff > v) ? 256 : diff;
+        }
+    }
+
+    static void convertGrayHueScalar(const uchar *src, uchar *gray, uchar *hue, int n, uchar value, const int *satLut) {
+        const int *hueDiv = hueDivTable();
+
+        for (int i = 0; i < n; ++i) {
+            const int b = src[3 * i], g = src[3 * i + 1], r = src[3 * i + 2];
+            gray[i] = static_cast<uchar>((b * GRAY_B + g * GRAY_G + r * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+
+            const int v = std::max({b, g, r});
+            const int diff = v - std::min({b, g, r});
+
+            // Blacks are mapped to blue, whites to yellow
+            if (v < value) {
+                hue[i] = 120;
+            } else if (diff < satLut[v]) {
+                hue[i] = 30;
+            } else {
+                int h = (v == r) ? g - b : (v == g) ? b - r + 2 * diff : r - g + 4 * diff;
+                h = (h * hueDiv[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+                hue[i] = static_cast<uchar>(h < 0 ? h + HUE_RANGE : h);
+            }
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("avx2")))
+    static void convertGrayHueAVX2(const uchar *src, uchar *gray, uchar *hue, int n, uchar value, const int *satLut) {
+        const int *hueDiv = hueDivTable();
+        const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        const __m256i byteMask = _mm256_set1_epi32(0xFF), vValue = _mm256_set1_epi32(value);
+        const __m256i grayB = _mm256_set1_epi32(GRAY_B), grayG = _mm256_set1_epi32(GRAY_G), grayR = _mm256_set1_epi32(GRAY_R);
+        const __m256i grayRound = _mm256_set1_epi32(1 << (GRAY_SHIFT - 1)), hsvRound = _mm256_set1_epi32(1 << (HSV_SHIFT - 1));
+        const __m256i blue = _mm256_set1_epi32(120), yellow = _mm256_set1_epi32(30), range = _mm256_set1_epi32(HUE_RANGE);
+        int i = 0;
+
+        // 8 pixels at once, each gather reads 4 bytes (1 byte past the last pixel of the block)
+        for (; i + 9 <= n; i += 8) {
+            __m256i px = _mm256_i32gather_epi32(reinterpret_cast<const int *>(src + 3 * i), offsets, 1);
+            __m256i b = _mm256_and_si256(px, byteMask);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byteMask);
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 16), byteMask);
+
+            // Gray
+            __m256i y = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(b, grayB), _mm256_mullo_epi32(g, grayG)),
+                                         _mm256_add_epi32(_mm256_mullo_epi32(r, grayR), grayRound));
+            y = _mm256_srli_epi32(y, GRAY_SHIFT);
+
+            // Hue
+            __m256i v = _mm256_max_epi32(_mm256_max_epi32(b, g), r);
+            __m256i diff = _mm256_sub_epi32(v, _mm256_min_epi32(_mm256_min_epi32(b, g), r));
+            __m256i two = _mm256_slli_epi32(diff, 1);
+            __m256i hR = _mm256_sub_epi32(g, b);
+            __m256i hG = _mm256_add_epi32(_mm256_sub_epi32(b, r), two);
+            __m256i hB = _mm256_add_epi32(_mm256_sub_epi32(r, g), _mm256_slli_epi32(two, 1));
+            __m256i h = _mm256_blendv_epi8(_mm256_blendv_epi8(hB, hG, _mm256_cmpeq_epi32(v, g)), hR, _mm256_cmpeq_epi32(v, r));
+            h = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(h, _mm256_i32gather_epi32(hueDiv, diff, 4)), hsvRound), HSV_SHIFT);
+            h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), range));
+
+            // Blacks are mapped to blue, whites to yellow
+            h = _mm256_blendv_epi8(h, yellow, _mm256_cmpgt_epi32(_mm256_i32gather_epi32(satLut, v, 4), diff));
+            h = _mm256_blendv_epi8(h, blue, _mm256_cmpgt_epi32(vValue, v));
+
+            // Pack both results to bytes, gray in lower and hue in upper 8 bytes
+            __m256i packed = _mm256_packs_epi32(y, h);
+            __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+            bytes = _mm_shuffle_epi32(bytes, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(gray + i), bytes);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(hue + i), _mm_unpackhi_epi64(bytes, bytes));
+        }
+
+        convertGrayHueScalar(src + 3 * i, gray + i, hue + i, n - i, value, satLut);
+    }
+#endif
+
+    void convertGrayHue(const uchar *src, uchar *gray, uchar *hue, int n, uchar value, const int *satLut) {
+#ifdef TLESS_X86
+        if (activeLevel == SimdLevel::AVX2) {
+            return convertGrayHueAVX2(src, gray, hue, n, value, satLut);
+        }
+#endif
+
+        convertGrayHueScalar(src, gray, hue, n, value, satLut);
+    }
+
+    // Normal and edgel kernels have to round the same way in scalar and SIMD code, so multiply and add must not be fused
+#if defined(__clang__)
+#define TLESS_FP_CONTRACT_OFF _Pragma("clang fp contract(off)")
+#else
+#define TLESS_FP_CONTRACT_OFF
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+    /**
+     * Applies bilateral filtering around each point A computing optimal gradient in b.
+     *
+     * @param[in]  delta         Depth difference of the sample and central pixel
+     * @param[in]  xShift        Patch shift in X direction (+/- patch), if shifted
+     * @param[in]  yShift        Patch shift in Y direction (+/- patch), if shifted
+     * @param[out] A             3 values of normal equations matrix
+     * @param[out] b             2 values of right side of normal equations
+     * @param[in]  maxDifference Ignore contributions of pixels whose depth difference with central
+     *                           pixel is above this threshold
+     */
+    static inline void accumulateBilateral(long delta, long xShift, long yShift, long *A, long *b, int maxDifference) {
+        long f = std::abs(delta) < maxDifference ? 1 : 0;
+
+        const long fx = f * xShift;
+        const long fy = f * yShift;
+
+        A[0] += fx * xShift;
+        A[1] += fx * yShift;
+        A[2] += fy * yShift;
+        b[0] += fx * delta;
+        b[1] += fy * delta;
+    }
+
+    static void quantizeNormalsScalar(const ushort *src, int step, uchar *dst, float *normals, int n, float fx, float fy, int maxDepth,
+                                      int maxDifference, const uchar *lut, int lutSize) {
+        TLESS_FP_CONTRACT_OFF
+        const int PS = NORMALS_PATCH;
+        const auto offset = static_cast<int>(lutSize * 0.5f);
+
+        for (int i = 0; i < n; ++i) {
+            const ushort *p = src + i;
+
+            // Get depth value at (x,y)
+            long d = p[0];
+
+            if (d >= maxDepth) {
+                dst[i] = 0; // Wrong depth
+                continue;
+            }
+
+            long A[3] = {0, 0, 0}, b[2] = {0, 0};
+
+            // Get 8 points around computing points in defined patch of size PS
+            accumulateBilateral(p[-PS - PS * step] - d, -PS, -PS, A, b, maxDifference);
+            accumulateBilateral(p[-PS * step] - d, 0, -PS, A, b, maxDifference);
+            accumulateBilateral(p[PS - PS * step] - d, +PS, -PS, A, b, maxDifference);
+            accumulateBilateral(p[-PS] - d, -PS, 0, A, b, maxDifference);
+            accumulateBilateral(p[PS] - d, +PS, 0, A, b, maxDifference);
+            accumulateBilateral(p[-PS + PS * step] - d, -PS, +PS, A, b, maxDifference);
+            accumulateBilateral(p[PS * step] - d, 0, +PS, A, b, maxDifference);
+            accumulateBilateral(p[PS + PS * step] - d, +PS, +PS, A, b, maxDifference);
+
+            // Solve
+            long det = A[0] * A[2] - A[1] * A[1];
+            long Dx = A[2] * b[0] - A[1] * b[1];
+            long Dy = -A[1] * b[0] + A[0] * b[1];
+
+            // Multiply differences by focal length
+            float Nx = fx * Dx;
+            float Ny = fy * Dy;
+            auto Nz = static_cast<float>(-det * d);
+
+            // Get normal vector size
+            float norm = std::sqrt(Nx * Nx + Ny * Ny + Nz * Nz);
+
+            if (norm > 0) {
+                float normInv = 1.0f / (norm);
+
+                // Normalize normal
+                Nx *= normInv;
+                Ny *= normInv;
+                Nz *= normInv;
+
+                // Save normals
+                if (normals != nullptr) {
+                    normals[3 * i] = -Nz;
+                    normals[3 * i + 1] = -Ny;
+                    normals[3 * i + 2] = Nx;
+                }
+
+                // Save quantized normals, ignore vZ, we quantize only in top half of sphere (cone)
+                auto vX = static_cast<int>(Nx * offset + offset);
+                auto vY = static_cast<int>(Ny * offset + offset);
+                dst[i] = lut[vY * lutSize + vX];
+            } else {
+                dst[i] = 0; // Discard shadows & distant objects from depth sensor
+            }
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("avx2")))
+    static void quantizeNormalsAVX2(const ushort *src, int step, uchar *dst, float *normals, int n, float fx, float fy, int maxDepth,
+                                    int maxDifference, const uchar *lut, int lutSize) {
+        TLESS_FP_CONTRACT_OFF
+        const int PS = NORMALS_PATCH;
+        const int offsets[8] = {-PS - PS * step, -PS * step, PS - PS * step, -PS, PS, -PS + PS * step, PS * step, PS + PS * step};
+        const int shiftsX[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+        const int shiftsY[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+        const auto offset = static_cast<float>(static_cast<int>(lutSize * 0.5f));
+
+        const __m256i vMaxDepth = _mm256_set1_epi32(maxDepth);
+        const __m256i vMaxDiff = _mm256_set1_epi32(maxDifference);
+        const __m256i v25 = _mm256_set1_epi32(PS * PS), v5 = _mm256_set1_epi32(PS);
+        const __m256 vFx = _mm256_set1_ps(fx), vFy = _mm256_set1_ps(fy), vOffset = _mm256_set1_ps(offset);
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        alignas(32) int idxX[8], idxY[8];
+        alignas(32) float nX[8], nY[8], nZ[8];
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+            const ushort *p = src + i;
+            __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+
+            // Sum valid depth differences of samples left/right/above/below and count valid samples (masks are -1)
+            __m256i sL = _mm256_setzero_si256(), sR = sL, sT = sL, sB = sL, cX = sL, cY = sL, cXY = sL;
+
+            for (int k = 0; k < 8; ++k) {
+                __m256i sample = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + offsets[k])));
+                __m256i delta = _mm256_sub_epi32(sample, d);
+                __m256i f = _mm256_cmpgt_epi32(vMaxDiff, _mm256_abs_epi32(delta));
+                __m256i fd = _mm256_and_si256(f, delta);
+
+                if (shiftsX[k] < 0) sL = _mm256_add_epi32(sL, fd);
+                if (shiftsX[k] > 0) sR = _mm256_add_epi32(sR, fd);
+                if (shiftsY[k] < 0) sT = _mm256_add_epi32(sT, fd);
+                if (shiftsY[k] > 0) sB = _mm256_add_epi32(sB, fd);
+                if (shiftsX[k] != 0) cX = _mm256_sub_epi32(cX, f);
+                if (shiftsY[k] != 0) cY = _mm256_sub_epi32(cY, f);
+                if (shiftsX[k] * shiftsY[k] > 0) cXY = _mm256_sub_epi32(cXY, f);
+                if (shiftsX[k] * shiftsY[k] < 0) cXY = _mm256_add_epi32(cXY, f);
+            }
+
+            // Normal equations (same integers as accumulateBilateral() produces)
+            __m256i A0 = _mm256_mullo_epi32(cX, v25), A1 = _mm256_mullo_epi32(cXY, v25), A2 = _mm256_mullo_epi32(cY, v25);
+            __m256i b0 = _mm256_mullo_epi32(_mm256_sub_epi32(sR, sL), v5), b1 = _mm256_mullo_epi32(_mm256_sub_epi32(sB, sT), v5);
+
+            // Solve
+            __m256i det = _mm256_sub_epi32(_mm256_mullo_epi32(A0, A2), _mm256_mullo_epi32(A1, A1));
+            __m256i Dx = _mm256_sub_epi32(_mm256_mullo_epi32(A2, b0), _mm256_mullo_epi32(A1, b1));
+            __m256i Dy = _mm256_sub_epi32(_mm256_mullo_epi32(A0, b1), _mm256_mullo_epi32(A1, b0));
+
+            // Multiply differences by focal length
+            __m256 Nx = _mm256_mul_ps(vFx, _mm256_cvtepi32_ps(Dx));
+            __m256 Ny = _mm256_mul_ps(vFy, _mm256_cvtepi32_ps(Dy));
+            __m256 Nz = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_setzero_si256(), _mm256_mullo_epi32(det, d)));
+
+            // Get normal vector size
+            __m256 norm = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Nx, Nx), _mm256_mul_ps(Ny, Ny)), _mm256_mul_ps(Nz, Nz)));
+            __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(vMaxDepth, d)), _mm256_cmp_ps(norm, zero, _CMP_GT_OQ));
+            const int validMask = _mm256_movemask_ps(valid);
+
+            // Normalize normal
+            __m256 normInv = _mm256_div_ps(one, norm);
+            Nx = _mm256_mul_ps(Nx, normInv);
+            Ny = _mm256_mul_ps(Ny, normInv);
+            Nz = _mm256_mul_ps(Nz, normInv);
+
+            // Look up table indices (only used for valid pixels)
+            _mm256_store_si256(reinterpret_cast<__m256i *>(idxX), _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(Nx, vOffset), vOffset)));
+            _mm256_store_si256(reinterpret_cast<__m256i *>(idxY), _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(Ny, vOffset), vOffset)));
+
+            if (normals != nullptr) {
+                _mm256_store_ps(nX, Nx);
+                _mm256_store_ps(nY, Ny);
+                _mm256_store_ps(nZ, Nz);
+            }
+
+            for (int j = 0; j < 8; ++j) {
+                if (((validMask >> j) & 1) == 0) {
+                    dst[i + j] = 0;
+                    continue;
+                }
+
+                dst[i + j] = lut[idxY[j] * lutSize + idxX[j]];
+
+                if (normals != nullptr) {
+                    normals[3 * (i + j)] = -nZ[j];
+                    normals[3 * (i + j) + 1] = -nY[j];
+                    normals[3 * (i + j) + 2] = nX[j];
+                }
+            }
+        }
+
+        quantizeNormalsScalar(src + i, step, dst + i, normals != nullptr ? normals + 3 * i : nullptr, n - i, fx, fy, maxDepth,
+                              maxDifference, lut, lutSize);
+    }
+#endif
+
+    static void detectEdgelsScalar(const ushort *src, int step, uchar *dst, int n, int minDepth, int maxDepth, float minMag2,
+                                   uchar lowValue, uchar highValue) {
+        TLESS_FP_CONTRACT_OFF
+        const ushort *r0 = src - step, *r1 = src, *r2 = src + step;
+
+        for (int i = 0; i < n; ++i) {
+            // Skip pixels whose 3x3 neighbourhood is not in range
+            int minPx = std::min({r0[i - 1], r0[i], r0[i + 1], r1[i - 1], r1[i], r1[i + 1], r2[i - 1], r2[i], r2[i + 1]});
+            int maxPx = std::max({r0[i - 1], r0[i], r0[i + 1], r1[i - 1], r1[i], r1[i + 1], r2[i - 1], r2[i], r2[i + 1]});
+
+            if (minPx < minDepth || maxPx > maxDepth) {
+                dst[i] = lowValue;
+                continue;
+            }
+
+            // Sobel 3x3
+            int sumX = (r0[i + 1] - r0[i - 1]) + 2 * (r1[i + 1] - r1[i - 1]) + (r2[i + 1] - r2[i - 1]);
+            int sumY = (r2[i - 1] + 2 * r2[i] + r2[i + 1]) - (r0[i - 1] + 2 * r0[i] + r0[i + 1]);
+            auto fx = static_cast<float>(sumX), fy = static_cast<float>(sumY);
+
+            dst[i] = (fx * fx + fy * fy > minMag2) ? highValue : lowValue;
+        }
+    }
+
+#ifdef TLESS_X86
+    __attribute__((target("avx2")))
+    static inline __m256i loadDepth(const ushort *src) {
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    }
+
+    __attribute__((target("avx2")))
+    static void detectEdgelsAVX2(const ushort *src, int step, uchar *dst, int n, int minDepth, int maxDepth, float minMag2,
+                                 uchar lowValue, uchar highValue) {
+        TLESS_FP_CONTRACT_OFF
+        const ushort *rows[3] = {src - step, src, src + step};
+        const __m256i vMinDepth = _mm256_set1_epi32(minDepth), vMaxDepth = _mm256_set1_epi32(maxDepth);
+        const __m256 vMinMag2 = _mm256_set1_ps(minMag2);
+        const __m128i vLow = _mm_set1_epi8(static_cast<char>(lowValue)), vHigh = _mm_set1_epi8(static_cast<char>(highValue));
+        int i = 0;
+
+        // 8 pixels at once, last load reads up to src[i + 8], which is the right border pixel at most
+        for (; i + 8 <= n; i += 8) {
+            __m256i px[3][3], minPx, maxPx;
+
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    px[r][c] = loadDepth(rows[r] + i + c - 1);
+                }
+            }
+
+            // Range of 3x3 neighbourhood
+            minPx = maxPx = px[0][0];
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    minPx = _mm256_min_epi32(minPx, px[r][c]);
+                    maxPx = _mm256_max_epi32(maxPx, px[r][c]);
+                }
+            }
+
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(vMinDepth, minPx), _mm256_cmpgt_epi32(maxPx, vMaxDepth));
+
+            // Sobel 3x3
+            __m256i sumX = _mm256_add_epi32(_mm256_add_epi32(_mm256_sub_epi32(px[0][2], px[0][0]),
+                                                             _mm256_slli_epi32(_mm256_sub_epi32(px[1][2], px[1][0]), 1)),
+                                            _mm256_sub_epi32(px[2][2], px[2][0]));
+            __m256i sumY = _mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(px[2][0], _mm256_slli_epi32(px[2][1], 1)), px[2][2]),
+                                            _mm256_add_epi32(_mm256_add_epi32(px[0][0], _mm256_slli_epi32(px[0][1], 1)), px[0][2]));
+            __m256 fx = _mm256_cvtepi32_ps(sumX), fy = _mm256_cvtepi32_ps(sumY);
+            __m256 mag2 = _mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy));
+            __m256i edge = _mm256_andnot_si256(outside, _mm256_castps_si256(_mm256_cmp_ps(mag2, vMinMag2, _CMP_GT_OQ)));
+
+            // Pack 32-bit masks to bytes and select output values
+            __m256i packed = _mm256_packs_epi32(edge, edge);
+            __m128i mask = _mm_unpacklo_epi64(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+            mask = _mm_packs_epi16(mask, mask);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_blendv_epi8(vLow, vHigh, mask));
+        }
+
+        detectEdgelsScalar(src + i, step, dst + i, n - i, minDepth, maxDepth, minMag2, lowValue, highValue);
+    }
+#endif
+
+#ifndef __clang__
+#pragma GCC pop_options
+#endif
+
+    void quantizeNormals(const ushort *src, int step, uchar *dst, float *normals, int n, float fx, float fy, int maxDepth,
+                         int maxDifference, const uchar *lut, int lutSize) {
+#ifdef TLESS_X86
+        if (activeLevel == SimdLevel::AVX2) {
+            return quantizeNormalsAVX2(src, step, dst, normals, n, fx, fy, maxDepth, maxDifference, lut, lutSize);
+        }
+#endif
+
+        quantizeNormalsScalar(src, step, dst, normals, n, fx, fy, maxDepth, maxDifference, lut, lutSize);
+    }
+
+    void detectEdgels(const ushort *src, int step, uchar *dst, int n, int minDepth, int maxDepth, int minMag, uchar lowValue,
+                      uchar highValue) {
+        // Compare squared magnitude, sqrt(mag2) > minMag holds for any mag2 when minMag is negative
+        const float minMag2 = (minMag < 0) ? -1.0f : static_cast<float>(minMag) * static_cast<float>(minMag);
+
+#ifdef TLESS_X86
+        if (activeLevel == SimdLevel::AVX2) {
+            return detectEdgelsAVX2(src, step, dst, n, minDepth, maxDepth, minMag2, lowValue, highValue);
+        }
+#endif
+
+        detectEdgelsScalar(src, step, dst, n, minDepth, maxDepth, minMag2, lowValue, highValue);
+    }
+}
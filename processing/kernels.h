@@ -0,0 +1,189 @@
+#ifndef VSB_SEMESTRAL_PROJECT_KERNELS_H
+#define VSB_SEMESTRAL_PROJECT_KERNELS_H
+
+#include <opencv2/core/hal/interface.h>
+#include <limits>
+
+namespace tless {
+    /**
+     * @brief Instruction sets vectorized kernels can run on, best supported one is picked at runtime.
+     */
+    enum class SimdLevel {
+        SCALAR = 0,
+        SSE = 1,
+        AVX2 = 2
+    };
+
+    /**
+     * @brief Returns instruction set currently used by vectorized kernels.
+     *
+     * @return Active SIMD level (detected from CPU features on first use)
+     */
+    SimdLevel simdLevel();
+
+    /**
+     * @brief Overrides instruction set used by vectorized kernels (mainly used in benchmarks).
+     *
+     * @param[in] level Requested SIMD level, it's clamped to the best level supported by current CPU
+     */
+    void setSimdLevel(SimdLevel level);
+
+    /**
+     * @brief Counts feature points, where quantized template feature shares at least one bit with spread scene feature.
+     *
+     * Scene bytes are gathered at all offsets, AND-ed with packed template features and
+     * matches are counted using movemask/popcount, 8 (AVX2) or 16 (SSE) points at once.
+     * Counting stops early once minScore can't be reached anymore (score + remaining points < minScore)
+     * or once maxScore is reached, returned score is then only a bound of the full score.
+     *
+     * @param[in]  src       Pointer to the first pixel of 8-bit spread feature image, it has to be readable
+     *                       at least 3 bytes past each offset (see spread())
+     * @param[in]  offsets   Linear offsets (y * step + x) of each feature point into src
+     * @param[in]  features  Quantized template features, one for each feature point
+     * @param[in]  N         Number of feature points
+     * @param[in]  minScore  Score the caller requires, counting stops when it can't be reached
+     * @param[in]  maxScore  Counting stops once the score reaches this value (use minScore when only pass/fail is needed)
+     * @param[out] evaluated Optional number of feature points that were evaluated
+     * @return               Number of matched feature points
+     */
+    int matchFeatures(const uchar *src, const int *offsets, const uchar *features, int N, int minScore = 0,
+                      int maxScore = std::numeric_limits<int>::max(), int *evaluated = nullptr);
+
+    /**
+     * @brief Adds one linearized response map row to similarity accumulator (saturating 8-bit addition).
+     *
+     * @param[in,out] dst Accumulated similarities, one for each window position
+     * @param[in]     src Row of linearized response map, shifted to currently processed feature point
+     * @param[in]     n   Number of window positions to accumulate
+     */
+    void addResponses(uchar *dst, const uchar *src, int n);
+
+    /**
+     * @brief ORs one row of 8-bit features into another (dst |= src), used to spread quantized features.
+     *
+     * @param[in,out] dst Destination row
+     * @param[in]     src Row to OR into dst (may be shifted by few pixels against dst)
+     * @param[in]     n   Number of bytes to process
+     */
+    void orBytes(uchar *dst, const uchar *src, int n);
+
+    /**
+     * @brief Adds bitset to bit-sliced (vertical) counters, each bit of the bitset increments counter at the same position.
+     *
+     * Counters are stored in planes, plane b holds b-th bit of all counters. Addition is a ripple carry
+     * across planes (AND for carry, XOR for sum), 4 (AVX2) or 2 (SSE) words at once.
+     *
+     * @param[in,out] planes Counter planes, plane b starts at planes + b * stride
+     * @param[in]     stride Number of words between two planes
+     * @param[in]     count  Number of planes (counters have to be wide enough not to overflow)
+     * @param[in]     bits   Bitset to add
+     * @param[in,out] any    Union of all added bitsets (bits are OR-ed into it)
+     * @param[in]     n      Number of words of the bitset
+     */
+    void addBitSliced(uint64 *planes, int stride, int count, const uint64 *bits, uint64 *any, int n);
+
+    /**
+     * @brief Compares bit-sliced (vertical) counters with a constant, 64 counters of each word at once.
+     *
+     * Planes are scanned from the most significant one, keeping masks of counters already greater than value
+     * and counters equal to value so far. Scan stops once no counter is equal, 4 (AVX2) or 2 (SSE) words at once.
+     *
+     * @param[in]  planes Counter planes, plane b starts at planes + b * stride
+     * @param[in]  stride Number of words between two planes
+     * @param[in]  count  Number of planes
+     * @param[in]  value  Value to compare counters with
+     * @param[in]  any    Mask of counters to compare (e.g. union of added bitsets), other counters are ignored
+     * @param[out] dst    Mask of counters, that are greater or equal to value
+     * @param[in]  n      Number of words to process
+     */
+    void compareBitSliced(const uint64 *planes, int stride, int count, int value, const uint64 *any, uint64 *dst, int n);
+
+    /**
+     * @brief Quantizes gradient orientations of one row of int16 Sobel responses into 5 bins (0-180deg).
+     *
+     * Instead of computing angles, gradient is rotated to upper half-plane and compared with bin boundaries
+     * (36, 72, 108, 144 deg) by signs of cross products with fixed-point boundary directions, magnitude is compared
+     * squared. AVX2 version processes 16 pixels at once, results are identical with scalar version.
+     *
+     * @param[in]  dx      Row of horizontal Sobel responses
+     * @param[in]  dy      Row of vertical Sobel responses
+     * @param[out] dst     Quantized orientations 1, 2, 4, 8, 16 (see quantizeGradientOrientation()), 0 for weak gradients
+     * @param[in]  n       Number of pixels to process
+     * @param[in]  minMag2 Squared minimum magnitude, gradients with gx^2 + gy^2 below it are weak
+     */
+    void quantizeGradients(const short *dx, const short *dy, uchar *dst, int n, int minMag2);
+
+    /**
+     * @brief Builds saturation look up table for convertGrayHue().
+     *
+     * Saturation of 8-bit HSV (as computed by OpenCV) is below the threshold exactly when max-min difference
+     * of BGR channels is below lut[V], so saturation itself doesn't have to be computed.
+     *
+     * @param[in]  saturation Saturation threshold
+     * @param[out] lut        Table of 256 minimal max-min differences, one for each value V (256 when unreachable)
+     */
+    void saturationLut(uchar saturation, int *lut);
+
+    /**
+     * @brief Converts one row of BGR image to gray and normalized hue in a single pass (see normalizeHSV()).
+     *
+     * Gray and hue are computed with the same fixed-point formulas as OpenCV BGR2GRAY and BGR2HSV conversions,
+     * so results are identical with cvtColor() followed by normalizeHSV(). AVX2 version processes 8 pixels at once.
+     *
+     * @param[in]  src    Row of 8-bit BGR image
+     * @param[out] gray   Row of 8-bit gray image
+     * @param[out] hue    Row of 8-bit normalized hue image
+     * @param[in]  n      Number of pixels to process
+     * @param[in]  value  Value threshold, pixels below it [blacks] are mapped to blue
+     * @param[in]  satLut Saturation look up table (see saturationLut()), pixels below saturation threshold are mapped to yellow
+     */
+    void convertGrayHue(const uchar *src, uchar *gray, uchar *hue, int n, uchar value, const int *satLut);
+
+    static const int NORMALS_PATCH = 5; //!< Distance of depth samples used to compute surface normal from the central pixel
+
+    /**
+     * @brief Computes quantized surface normals for one row of depth image.
+     *
+     * Normal of each pixel is estimated by least squares from 8 depth samples NORMALS_PATCH pixels around it (see quantizedNormals()).
+     * AVX2 version processes 8 pixels at once in 32-bit integer and float lanes, integer part of the computation is
+     * exact and float operations are evaluated in the same order without fused multiply-add, so results of all
+     * versions are bit-identical.
+     *
+     * @param[in]  src           Pointer to the first pixel of the row in 16-bit depth image, NORMALS_PATCH pixels around
+     *                           each pixel of the row have to be readable
+     * @param[in]  step          Number of elements between two rows of src
+     * @param[out] dst           Quantized normals (looked up in lut), 0 for invalid pixels
+     * @param[out] normals       Optional 3D normals (3 floats for each pixel), only written for valid pixels
+     * @param[in]  n             Number of pixels to process
+     * @param[in]  fx            Camera focal length in X direction
+     * @param[in]  fy            Camera focal length in Y direction
+     * @param[in]  maxDepth      Ignore pixels beyond this depth
+     * @param[in]  maxDifference Ignore depth samples whose depth difference with central pixel is above this threshold
+     * @param[in]  lut           Square look up table of quantized normals indexed by normal x and y components
+     * @param[in]  lutSize       Size of lut in each direction
+     */
+    void quantizeNormals(const ushort *src, int step, uchar *dst, float *normals, int n, float fx, float fy, int maxDepth,
+                         int maxDifference, const uchar *lut, int lutSize);
+
+    /**
+     * @brief Detects depth edgels in one row of depth image using 3x3 Sobel operator.
+     *
+     * Pixel is an edgel when all pixels of it's 3x3 neighbourhood are within [minDepth, maxDepth] and squared gradient
+     * magnitude is above minMag^2. AVX2 version processes 8 pixels at once, results are identical with scalar version.
+     *
+     * @param[in]  src       Pointer to the first pixel of the row in 16-bit depth image, 1 pixel around each pixel
+     *                       of the row has to be readable
+     * @param[in]  step      Number of elements between two rows of src
+     * @param[out] dst       Output row, highValue for edgels, otherwise lowValue
+     * @param[in]  n         Number of pixels to process
+     * @param[in]  minDepth  Ignore pixels with depth lower then this threshold
+     * @param[in]  maxDepth  Ignore pixels with depth higher then this threshold
+     * @param[in]  minMag    Ignore pixels with edge magnitude lower than this
+     * @param[in]  lowValue  Value used for non existing edgels
+     * @param[in]  highValue Value used for edgels
+     */
+    void detectEdgels(const ushort *src, int step, uchar *dst, int n, int minDepth, int maxDepth, int minMag, uchar lowValue,
+                      uchar highValue);
+}
+
+#endif
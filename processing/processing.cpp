@@ -1,135 +1,36 @@
 #include "processing.h"
 #include "../objdetect/hasher.h"
 #include "computation.h"
+#include "kernels.h"
 #include <cassert>
 #include <opencv2/imgproc.hpp>
 #include <iostream>
 #include <opencv/cv.hpp>
 
 namespace tless {
-    /**
-     * Applies bilateral filtering around each point A computing optimal gradient in b.
-     *
-     * Each point A represents a filtered depth to compute normal from, where
-     * A[0] is origin. b represents optimal gradient computed across origin b[0]
-     * and
-     *
-     * @param[in]  delta         Current pixel depth value
-     * @param[in]  xShift        Patch shift in X direction (+/- patch), if shifted
-     * @param[in]  yShift        Patch shift in Y direction (+/- patch), if shifted
-     * @param[out] A             3 Points to compute bilateral filter for
-     * @param[out] b             2 Values, containing optimal[1] and depth gradient[0]
-     * @param[in]  maxDifference Ignore contributions of pixels whose depth difference with central
-     *                            pixel is above this threshold
-     */
-    static void accumulateBilateral(long delta, long xShift, long yShift, long *A, long *b, int maxDifference) {
-        long f = std::abs(delta) < maxDifference ? 1 : 0;
-
-        const long fx = f * xShift;
-        const long fy = f * yShift;
-
-        A[0] += fx * xShift;
-        A[1] += fx * yShift;
-        A[2] += fy * yShift;
-        b[0] += fx * delta;
-        b[1] += fy * delta;
-    }
-
-    void quantizedNormals(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstNormals, float fx, float fy, int maxDepth, int maxDifference) {
+    void quantizedNormals(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstNormals, float fx, float fy, int maxDepth, int maxDifference,
+                          bool normals3D) {
         assert(!src.empty());
         assert(src.type() == CV_16UC1);
 
-        int PS = 5; // patch size
+        const int PS = NORMALS_PATCH;
         dst = cv::Mat::zeros(src.size(), CV_8UC1);
-        dstNormals = cv::Mat::zeros(src.size(), CV_32FC3);
-        auto offsetX = static_cast<int>(NORMAL_LUT_SIZE * 0.5f);
-        auto offsetY = static_cast<int>(NORMAL_LUT_SIZE * 0.5f);
-
-        // Get pointers and steps
-        auto step = static_cast<int>(src.step1());
-        auto stepNormals = static_cast<int>(src.step1());
-        const auto *src_p = src.ptr<ushort>();
-        auto *dst_p = dst.ptr<uchar>();
-        auto *normals_p = dstNormals.ptr<cv::Vec3f>();
-
-        // Offsets
-        const int off1 = -PS - PS * step;
-        const int off2 =  0 - PS * step;
-        const int off3 = +PS - PS * step;
-        const int off4 = -PS;
-        const int off5 = +PS;
-        const int off6 = -PS + PS * step;
-        const int off7 =  0 + PS * step;
-        const int off8 = +PS + PS * step;
-
-        #pragma omp parallel for default(none) shared(src_p, dst_p, normals_p, NORMAL_LUT) firstprivate(step, stepNormals, fx, fy, maxDepth, maxDifference, PS, offsetX, offsetY)
-        for (int y = PS; y < src.rows - PS; y++) {
-            const ushort *row_src = src_p + (y * step + PS);
-            uchar *row_dst = dst_p + (y * step + PS);
-            cv::Vec3f *row_normals = normals_p + (y * stepNormals + PS);
-
-            for (int x = PS; x < src.cols - PS; x++) {
-                // Get depth value at (x,y)
-                long d = row_src[0];
-
-                if (d < maxDepth) {
-                    long A[3], b[2];
-                    A[0] = A[1] = A[2] = 0;
-                    b[0] = b[1] = 0;
-
-                    // Get 8 points around computing points in defined patch of size PS
-                    accumulateBilateral(row_src[off1] - d, -PS, -PS, A, b, maxDifference);
-                    accumulateBilateral(row_src[off2] - d, 0, -PS, A, b, maxDifference);
-                    accumulateBilateral(row_src[off3] - d, +PS, -PS, A, b, maxDifference);
-                    accumulateBilateral(row_src[off4] - d, -PS, 0, A, b, maxDifference);
-                    accumulateBilateral(row_src[off5] - d, +PS, 0, A, b, maxDifference);
-                    accumulateBilateral(row_src[off6] - d, -PS, +PS, A, b, maxDifference);
-                    accumulateBilateral(row_src[off7] - d, 0, +PS, A, b, maxDifference);
-                    accumulateBilateral(row_src[off8] - d, +PS, +PS, A, b, maxDifference);
-
-                    // Solve
-                    long det = A[0] * A[2] - A[1] * A[1];
-                    long Dx = A[2] * b[0] - A[1] * b[1];
-                    long Dy = -A[1] * b[0] + A[0] * b[1];
-
-                    // Multiply differences by focal length
-                    float Nx = fx * Dx;
-                    float Ny = fy * Dy;
-                    auto Nz = static_cast<float>(-det * d);
-
-                    // Get normal vector size
-                    float norm = std::sqrt(Nx * Nx + Ny * Ny + Nz * Nz);
-
-                    if (norm > 0) {
-                        float normInv = 1.0f / (norm);
-
-                        // Normalize normal
-                        Nx *= normInv;
-                        Ny *= normInv;
-                        Nz *= normInv;
-
-                        // Save normals
-                        *row_normals = cv::Vec3f(-Nz, -Ny, Nx);
-
-                        // Get values for pre-generated Normal look up table
-                        auto vX = static_cast<int>(Nx * offsetX + offsetX);
-                        auto vY = static_cast<int>(Ny * offsetY + offsetY);
-                        // auto vZ = static_cast<int>(Nz * NORMAL_LUT_SIZE + NORMAL_LUT_SIZE);
-
-                        // Save quantized normals, ignore vZ, we quantize only in top half of sphere (cone)
-                        *row_dst = NORMAL_LUT[vY][vX];
-                        // *row_dst = static_cast<uchar>(std::fabs(Nz) * 255); // Lambert
-                    } else {
-                        *row_dst = 0; // Discard shadows & distant objects from depth sensor
-                    }
-                } else {
-                    *row_dst = 0; // Wrong depth
-                }
 
-                row_normals++;
-                row_dst++;
-                row_src++;
-            }
+        if (normals3D) {
+            dstNormals = cv::Mat::zeros(src.size(), CV_32FC3);
+        } else {
+            dstNormals.release();
+        }
+
+        // Compute normals row by row using vectorized kernel
+        const auto step = static_cast<int>(src.step1());
+        const int n = src.cols - 2 * PS;
+
+        #pragma omp parallel for default(none) shared(src, dst, dstNormals, NORMAL_LUT) firstprivate(step, n, fx, fy, maxDepth, maxDifference, normals3D)
+        for (int y = PS; y < src.rows - PS; y++) {
+            float *rowNormals = normals3D ? dstNormals.ptr<float>(y) + 3 * PS : nullptr;
+            quantizeNormals(src.ptr<ushort>(y) + PS, step, dst.ptr<uchar>(y) + PS, rowNormals, n, fx, fy, maxDepth, maxDifference,
+                            &NORMAL_LUT[0][0], NORMAL_LUT_SIZE);
         }
 
         cv::medianBlur(dst, dst, 5);
@@ -139,38 +40,20 @@ namespace tless {
         assert(!src.empty());
         assert(src.type() == CV_16U);
 
-        const int filterX[9] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
-        const int filterY[9] = {-1, -2, -1, 0, 0, 0, 1, 2, 1};
-        dst = cv::Mat::ones(src.size(), CV_8U) * lowValue;
+        // Reuses dst when it's already allocated with the same size
+        dst.create(src.size(), CV_8U);
+        const auto step = static_cast<int>(src.step1());
+        const auto low = static_cast<uchar>(lowValue), high = static_cast<uchar>(highValue);
 
-        #pragma omp parallel for default(none) shared(src, dst, filterX, filterY) firstprivate(minDepth, maxDepth, minMag, lowValue, highValue)
-        for (int y = 1; y < src.rows - 1; y++) {
-            for (int x = 1; x < src.cols - 1; x++) {
-                int i = 0, sumX = 0, sumY = 0;
-                bool skip = false;
-
-                for (int yy = 0; yy < 3 && !skip; yy++) {
-                    for (int xx = 0; xx < 3; xx++) {
-                        int px = src.at<ushort>(yy + y - 1, x + xx - 1);
-
-                        // Skip pixels out range
-                        if (px < minDepth || px > maxDepth) {
-                            skip = true;
-                            break;
-                        }
-
-                        sumX += px * filterX[i];
-                        sumY += px * filterY[i];
-                        i++;
-                    }
-                }
-
-                if (skip) {
-                    continue;
-                }
+        // Borders are never edgels
+        dst.row(0).setTo(cv::Scalar(low));
+        dst.row(dst.rows - 1).setTo(cv::Scalar(low));
 
-                dst.at<uchar>(y, x) = static_cast<uchar>((std::sqrt(sqr<float>(sumX) + sqr<float>(sumY)) > minMag) ? highValue : lowValue);
-            }
+        #pragma omp parallel for default(none) shared(src, dst) firstprivate(step, minDepth, maxDepth, minMag, low, high)
+        for (int y = 1; y < src.rows - 1; y++) {
+            uchar *row = dst.ptr<uchar>(y);
+            row[0] = row[src.cols - 1] = low;
+            detectEdgels(src.ptr<ushort>(y) + 1, step, row + 1, src.cols - 2, minDepth, maxDepth, minMag, low, high);
         }
     }
 
@@ -206,6 +89,21 @@ namespace tless {
         }
     }
 
+    void grayHue(const cv::Mat &src, cv::Mat &gray, cv::Mat &hue, uchar value, uchar saturation) {
+        assert(!src.empty());
+        assert(src.type() == CV_8UC3);
+
+        gray.create(src.size(), CV_8UC1);
+        hue.create(src.size(), CV_8UC1);
+        int satLut[256];
+        saturationLut(saturation, satLut);
+
+        #pragma omp parallel for default(none) shared(src, gray, hue, satLut) firstprivate(value)
+        for (int y = 0; y < src.rows; y++) {
+            convertGrayHue(src.ptr<uchar>(y), gray.ptr<uchar>(y), hue.ptr<uchar>(y), src.cols, value, satLut);
+        }
+    }
+
     void nms(std::vector<Match> &matches, float maxOverlap) {
         if (matches.empty()) return;
 
@@ -266,25 +164,18 @@ namespace tless {
         assert(src.type() == CV_8UC1);
 
         // Compute sobel
-        cv::Mat gradX, gradY, mags, angles;
-        cv::Sobel(src, gradX, CV_32F, 1, 0, 3, 1, 0);
-        cv::Sobel(src, gradY, CV_32F, 0, 1, 3, 1, 0);
+        cv::Mat gradX, gradY;
+        cv::Sobel(src, gradX, CV_16S, 1, 0, 3, 1, 0);
+        cv::Sobel(src, gradY, CV_16S, 0, 1, 3, 1, 0);
 
-        // Compute angles and magnitudes
-        cv::cartToPolar(gradX, gradY, mags, angles, true);
+        // Magnitudes are compared squared, gx^2 + gy^2 is integer so the threshold can be rounded up
+        const int minMag2 = (minMag > 0) ? static_cast<int>(std::ceil(minMag * minMag)) : 0;
+        dst.create(src.size(), CV_8UC1);
 
         // Quantize orientations
-        dst = cv::Mat::zeros(src.size(), CV_8UC1);
-        cv::Mat grad = cv::Mat(src.size(), CV_32FC1);
-
+        #pragma omp parallel for default(none) shared(gradX, gradY, dst) firstprivate(minMag2)
         for (int y = 0; y < dst.rows; y++) {
-            for (int x = 0; x < dst.cols; x++) {
-                // Check for min
-                if (mags.at<float>(y, x) < minMag) { continue; }
-
-                // Quantize orientations
-                dst.at<uchar>(y, x) = quantizeGradientOrientation(angles.at<float>(y, x));
-            }
+            quantizeGradients(gradX.ptr<short>(y), gradY.ptr<short>(y), dst.ptr<uchar>(y), dst.cols, minMag2);
         }
     }
 
@@ -309,21 +200,124 @@ namespace tless {
     }
 
     void spread(const cv::Mat &src, cv::Mat &dst, int T) {
-        dst = cv::Mat::zeros(src.size(), CV_8U);
+        assert(!src.empty());
+        assert(src.type() == CV_8UC1);
+        assert(T % 2 == 1);
+
+        // Allocate one extra row, so vectorized kernels can safely read few bytes past the last pixel
+        cv::Mat padded = cv::Mat::zeros(src.rows + 1, src.cols, CV_8U);
+        dst = padded.rowRange(0, src.rows);
         const int offset = T / 2;
+        cv::Mat rows = src.clone();
 
-        // Loop through image and spread quantized features
-        for (int y = offset; y < src.rows - offset; y++) {
-            for (int x = offset; x < src.cols - offset; x++) {
-                auto px = src.at<uchar>(y, x);
+        // Spread features in rows, OR each row with it's copies shifted by 1 to offset pixels in both directions
+        #pragma omp parallel for default(none) shared(src, rows) firstprivate(offset)
+        for (int y = 0; y < src.rows; y++) {
+            const uchar *row = src.ptr<uchar>(y);
+            uchar *rowDst = rows.ptr<uchar>(y);
 
-                for (int yy = y - offset; yy < y + offset; yy++) {
-                    for (int xx = x - offset; xx < x + offset; xx++) {
-                        px |= src.at<uchar>(yy, xx);
-                    }
+            for (int k = 1; k <= offset && k < src.cols; k++) {
+                orBytes(rowDst, row + k, src.cols - k);
+                orBytes(rowDst + k, row, src.cols - k);
+            }
+        }
+
+        // Spread features in columns
+        #pragma omp parallel for default(none) shared(src, rows, dst) firstprivate(offset)
+        for (int y = 0; y < src.rows; y++) {
+            uchar *rowDst = dst.ptr<uchar>(y);
+
+            for (int yy = std::max(0, y - offset); yy <= std::min(src.rows - 1, y + offset); yy++) {
+                orBytes(rowDst, rows.ptr<uchar>(yy), src.cols);
+            }
+        }
+    }
+
+    void spreadDepth(const cv::Mat &src, cv::Mat &dstMin, cv::Mat &dstMax, int T) {
+        assert(!src.empty());
+        assert(src.type() == CV_16U);
+        assert(T % 2 == 1);
+
+        // Default border value of erosion (dilation) is max (min) value, pixels outside of the image are ignored
+        cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(T, T));
+        cv::erode(src, dstMin, kernel);
+        cv::dilate(src, dstMax, kernel);
+    }
+
+    void spreadHue(const cv::Mat &src, cv::Mat &dst, int T) {
+        assert(!src.empty());
+        assert(src.type() == CV_8UC1);
+        assert(T % 2 == 1);
+
+        const int offset = T / 2;
+        cv::Mat rows(src.size(), CV_32SC2);
+        dst.create(src.size(), CV_32SC2);
+
+        // Quantize hue and spread bins in rows
+        #pragma omp parallel for default(none) shared(src, rows) firstprivate(offset)
+        for (int y = 0; y < src.rows; y++) {
+            const uchar *row = src.ptr<uchar>(y);
+            auto *rowDst = rows.ptr<uint64>(y);
+
+            for (int x = 0; x < src.cols; x++) {
+                uint64 bins = 0;
+
+                for (int xx = std::max(0, x - offset); xx <= std::min(src.cols - 1, x + offset); xx++) {
+                    bins |= 1ull << (row[xx] / HUE_BIN_WIDTH);
                 }
 
-                dst.at<uchar>(y, x) = px;
+                rowDst[x] = bins;
+            }
+        }
+
+        // Spread bins in columns
+        #pragma omp parallel for default(none) shared(src, rows, dst) firstprivate(offset)
+        for (int y = 0; y < src.rows; y++) {
+            auto *rowDst = dst.ptr<uint64>(y);
+
+            for (int x = 0; x < src.cols; x++) {
+                rowDst[x] = 0;
+            }
+
+            for (int yy = std::max(0, y - offset); yy <= std::min(src.rows - 1, y + offset); yy++) {
+                const auto *row = rows.ptr<uint64>(yy);
+
+                for (int x = 0; x < src.cols; x++) {
+                    rowDst[x] |= row[x];
+                }
+            }
+        }
+    }
+
+    void responseMaps(const cv::Mat &src, std::vector<cv::Mat> &dst, int bins, int T) {
+        assert(!src.empty());
+        assert(src.type() == CV_8UC1);
+        assert(bins > 0 && bins <= 8);
+        assert(T > 0);
+
+        const int gridW = src.cols / T, gridH = src.rows / T;
+        dst.resize(bins);
+
+        for (auto &map : dst) {
+            map.create(T * T, gridW * gridH, CV_8UC1);
+        }
+
+        // Each row of linearized memory belongs to one position inside TxT cell
+        #pragma omp parallel for default(none) shared(src, dst) firstprivate(gridW, gridH, bins, T)
+        for (int r = 0; r < T * T; ++r) {
+            const int rY = r / T, rX = r % T;
+
+            for (int j = 0; j < gridH; ++j) {
+                const uchar *row = src.ptr<uchar>(j * T + rY) + rX;
+                const int offset = j * gridW;
+
+                for (int o = 0; o < bins; ++o) {
+                    uchar *lin = dst[o].ptr<uchar>(r) + offset;
+
+                    for (int k = 0; k < gridW; ++k) {
+                        lin[k] = static_cast<uchar>((row[k * T] >> o) & 1);
+                    }
+                }
             }
         }
     }
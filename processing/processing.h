@@ -9,6 +9,7 @@
 namespace tless {
     // Lookup tables
     static const int NORMAL_LUT_SIZE = 20, DEPTH_LUT_SIZE = 5;
+    static const int HUE_BIN_WIDTH = 4, HUE_BINS = 64; //!< Hue values are quantized into 64 bins of 4 values (whole 8-bit range)
     static const uchar DEPTH_LUT[DEPTH_LUT_SIZE] = {1, 2, 4, 8, 16};
     static const uchar NORMAL_LUT[NORMAL_LUT_SIZE][NORMAL_LUT_SIZE] = {
             {32, 32, 32, 32, 32, 32, 64, 64, 64, 64, 64, 64,  64,  64,  64,  128, 128, 128, 128, 128},
@@ -46,14 +47,19 @@ namespace tless {
      * @param[in]  maxDepth      Ignore pixels beyond this depth
      * @param[in]  maxDifference When computing surface normals, ignore contributions of
      *                           pixels whose depth difference with central pixel is above this threshold
+     * @param[in]  normals3D     Compute dstNormals as well, when false dstNormals is released (quantized normals only)
      */
-    void quantizedNormals(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstNormals, float fx, float fy, int maxDepth, int maxDifference);
+    void quantizedNormals(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstNormals, float fx, float fy, int maxDepth, int maxDifference,
+                          bool normals3D = true);
 
     /**
      * @brief Generates binary image of visible depth edgels, detected in depth image within (min, max) depths.
      *
+     * Rows are processed by vectorized detectEdgels() kernel, gradient magnitude is compared squared (no sqrt).
+     *
      * @param[in]  src       Source 16-bit depth image (in mm)
-     * @param[out] dst       8-bit uchar binary image containing 1 where edgels arise in depth image
+     * @param[out] dst       8-bit uchar binary image containing 1 where edgels arise in depth image, reused without
+     *                       allocation when it already has the size of src and 8-bit type
      * @param[in]  minDepth  Ignore pixels with depth lower then this threshold
      * @param[in]  maxDepth  Ignore pixels with depth higher then this threshold
      * @param[in]  minMag    Ignore pixels with edge magnitude lower than this
@@ -82,6 +88,19 @@ namespace tless {
      */
     void normalizeHSV(const cv::Mat &src, cv::Mat &dst, uchar value = 30, uchar saturation = 40);
 
+    /**
+     * @brief Converts BGR image to gray and normalized hue images in a single pass (no intermediate HSV image).
+     *
+     * Results are identical with cvtColor() to gray, cvtColor() to HSV and normalizeHSV().
+     *
+     * @param[in]  src        Input 8-bit BGR image
+     * @param[out] gray       8-bit gray image
+     * @param[out] hue        Normalized 8-bit 1-channel image containing hue values (see normalizeHSV())
+     * @param[in]  value      Value threshold, values below this threshold [blacks] are mapped to blue color
+     * @param[in]  saturation Saturation threshold, values below this and above value threshold [white] are mapped to yellow color
+     */
+    void grayHue(const cv::Mat &src, cv::Mat &gray, cv::Mat &hue, uchar value = 30, uchar saturation = 40);
+
     /**
      * @brief Applies non-maxima suppression to matches, removing matches with large overlap and lower score.
      *
@@ -105,6 +124,9 @@ namespace tless {
     /**
      * @brief Computes and quantizes gradient orientations over RGB scene
      *
+     * Orientations are quantized from int16 Sobel responses by vectorized quantizeGradients() kernel without
+     * computing angles and magnitudes (see quantizeGradientOrientation() for bins).
+     *
      * @param[in]  src    8-bit gray image to compute gradients on
      * @param[out] dst    8-bit image map of quantized gradient orientations
      * @param[in]  minMag Minimum edge magnitude to consider as valid and compute orientation for
@@ -120,14 +142,53 @@ namespace tless {
     uchar quantizeGradientOrientation(float deg);
 
     /**
-     * @brief Spread quantized features in src image in TxT patch around every pixel
+     * @brief Spread quantized features in src image in TxT patch around every pixel (pixels outside of the image are ignored).
+     *
+     * Patch is separable, features are OR-ed in rows first and then in columns, O(T) vectorized ORs per pixel.
+     * Destination image is backed by one extra zero row, so it can be read by gathering
+     * kernels (see matchFeatures()), which load whole 32-bit words at each pixel offset.
      *
      * @param[in]  src 8-bit input image of quantized features
      * @param[out] dst 8-bit spread feature version of input image
-     * @param[in]  T   Size of the patch TxT
+     * @param[in]  T   Size of the patch TxT (odd number, patch is centered at each pixel)
      */
     void spread(const cv::Mat& src, cv::Mat& dst, int T);
 
+    /**
+     * @brief Computes minimum and maximum depth in TxT patch around every pixel (pixels outside of the image are ignored).
+     *
+     * @param[in]  src    16-bit depth image
+     * @param[out] dstMin 16-bit image of minimum depths in the patch
+     * @param[out] dstMax 16-bit image of maximum depths in the patch
+     * @param[in]  T      Size of the patch TxT (odd number, patch is centered at each pixel)
+     */
+    void spreadDepth(const cv::Mat &src, cv::Mat &dstMin, cv::Mat &dstMax, int T);
+
+    /**
+     * @brief Quantizes hue values into HUE_BINS bins and spreads them in TxT patch around every pixel.
+     *
+     * @param[in]  src 8-bit normalized hue image
+     * @param[out] dst 64-bit bitmask image (stored as CV_32SC2, access as uint64), where bit b is set if
+     *                 there's a hue value from bin b (hue / HUE_BIN_WIDTH) in the patch
+     * @param[in]  T   Size of the patch TxT (odd number, patch is centered at each pixel)
+     */
+    void spreadHue(const cv::Mat &src, cv::Mat &dst, int T);
+
+    /**
+     * @brief Computes linearized response maps, one for each quantized orientation in spread feature image.
+     *
+     * Response map of orientation o contains 1 where spread feature image contains bit o, otherwise 0. Each response
+     * map is linearized (LINE-MOD) for sliding window step T, e.g. row (y % T) * T + (x % T) holds response
+     * values of all pixels sharing the same position inside TxT cell, ordered as (y / T) * (cols / T) + (x / T).
+     * Feature point (px, py) of all windows placed on the TxT grid can be then accessed as one contiguous memory block.
+     *
+     * @param[in]  src  8-bit spread feature image
+     * @param[out] dst  Array of 8-bit linearized response maps, one for each orientation (T * T rows)
+     * @param[in]  bins Number of quantized orientations (bits) in src image
+     * @param[in]  T    Sliding window step, defines size of the linearization cell
+     */
+    void responseMaps(const cv::Mat &src, std::vector<cv::Mat> &dst, int bins, int T);
+
     /**
      * @brief Applies simple objectness detection on input depth image based on depth discontinuities.
      *
@@ -0,0 +1,258 @@
+#include "benchmark.h"
+#include <omp.h>
+#include <cstring>
+#include "timer.h"
+#include "../processing/processing.h"
+#include "../processing/kernels.h"
+
+namespace tless {
+    void Benchmark::prepareScene(const std::string &scenesFolder, int sceneId, int index, Scene &scene,
+                                 std::vector<std::vector<Window>> &windows, bool verify) {
+        cv::Ptr<ClassifierCriteria> criteria = classifier.criteria;
+        const int pyrLevels = criteria->pyrLvlsDown + criteria->pyrLvlsUp;
+        const auto minEdgels = static_cast<const int>(criteria->info.minEdgels * criteria->objectnessFactor);
+        const auto minDepthMag = static_cast<const int>(criteria->objectnessDiameterThreshold * criteria->info.smallestDiameter * criteria->info.depthScaleFactor);
+
+        // Load scene
+        std::string scenePath = cv::format((scenesFolder + "%02d/").c_str(), sceneId);
+        scene = classifier.parser.parseScene(scenePath, index, criteria->pyrScaleFactor, criteria->pyrLvlsDown, criteria->pyrLvlsUp);
+        windows.clear();
+        windows.resize(pyrLevels + 1);
+
+        for (int l = 0; l <= pyrLevels; ++l) {
+            objectness(scene.pyramid[l].srcDepth, scene.pyramid[l].srcDepthEdgels, windows[l], criteria->info.smallestTemplate,
+                       criteria->windowStep, criteria->info.minDepth, criteria->info.maxDepth, minDepthMag, minEdgels);
+
+            if (verify && !windows[l].empty()) {
+                classifier.hasher.verifyCandidates(scene.pyramid[l].srcDepth, scene.pyramid[l].srcNormals, classifier.tables,
+                                                   classifier.store, windows[l]);
+            }
+        }
+    }
+
+    double Benchmark::runHashing(Scene &scene, const std::vector<std::vector<Window>> &objectness, std::vector<std::vector<Window>> &windows) {
+        windows = objectness;
+        Timer tHashing;
+
+        for (size_t l = 0; l < windows.size(); ++l) {
+            if (!windows[l].empty()) {
+                classifier.hasher.verifyCandidates(scene.pyramid[l].srcDepth, scene.pyramid[l].srcNormals, classifier.tables,
+                                                   classifier.store, windows[l]);
+            }
+        }
+
+        return tHashing.elapsed();
+    }
+
+    double Benchmark::runMatching(Scene &scene, std::vector<std::vector<Window>> &windows, std::vector<Match> &matches) {
+        Timer tMatching;
+
+        for (size_t l = 0; l < windows.size(); ++l) {
+            if (!windows[l].empty()) {
+                classifier.matcher.match(scene.pyramid[l], classifier.store, windows[l], matches);
+            }
+        }
+
+        return tMatching.elapsed();
+    }
+
+    void Benchmark::matchingOrder(const std::string &scenesFolder, int sceneId, int index, int runs) {
+        assert(runs > 0);
+        cv::Ptr<ClassifierCriteria> criteria = classifier.criteria;
+        const bool linearMatching = criteria->linearMatching, templateMajor = criteria->templateMajor;
+
+        Scene scene;
+        std::vector<std::vector<Window>> windows;
+        prepareScene(scenesFolder, sceneId, index, scene, windows);
+
+        // Count evaluated (window, candidate) pairs
+        size_t pairs = 0;
+        for (auto &level : windows) {
+            for (auto &window : level) {
+                pairs += window.candidates.size();
+            }
+        }
+
+        std::cout << "Matching order benchmark..." << std::endl;
+        std::cout << "  |_ Scene " << sceneId << ", image " << index << ", candidates: " << pairs << std::endl;
+        criteria->linearMatching = false;
+
+        for (int order = 0; order < 2; ++order) {
+            criteria->templateMajor = (order == 1);
+            std::vector<Match> matches;
+            double elapsed = 0;
+
+            for (int i = 0; i < runs; ++i) {
+                matches.clear();
+                classifier.matcher.stats.reset();
+                elapsed += runMatching(scene, windows, matches);
+            }
+
+            std::cout << "  |_ " << (criteria->templateMajor ? "template-major" : "window-major") << " took: "
+                      << elapsed / runs << "s, matches: " << matches.size() << std::endl;
+            std::cout << "  " << classifier.matcher.stats << std::endl;
+        }
+
+        // Restore criteria
+        criteria->linearMatching = linearMatching;
+        criteria->templateMajor = templateMajor;
+        std::cout << std::endl;
+    }
+
+    void Benchmark::threadScaling(const std::string &scenesFolder, int sceneId, int index, int maxThreads, int runs) {
+        assert(runs > 0);
+        const int defaultThreads = omp_get_max_threads();
+        maxThreads = (maxThreads > 0) ? maxThreads : defaultThreads;
+
+        Scene scene;
+        std::vector<std::vector<Window>> windows;
+        prepareScene(scenesFolder, sceneId, index, scene, windows);
+
+        std::cout << "Thread scaling benchmark..." << std::endl;
+        std::cout << "  |_ Scene " << sceneId << ", image " << index << std::endl;
+        double base = 0;
+
+        for (int threads = 1; threads <= maxThreads; ++threads) {
+            omp_set_num_threads(threads);
+            std::vector<Match> matches;
+            double elapsed = 0;
+
+            for (int i = 0; i < runs; ++i) {
+                matches.clear();
+                elapsed += runMatching(scene, windows, matches);
+            }
+
+            elapsed /= runs;
+            base = (threads == 1) ? elapsed : base;
+            std::cout << "  |_ threads: " << threads << ", took: " << elapsed << "s, speedup: " << base / elapsed
+                      << ", efficiency: " << base / elapsed / threads << ", matches: " << matches.size() << std::endl;
+        }
+
+        // Restore default number of threads
+        omp_set_num_threads(defaultThreads);
+        std::cout << std::endl;
+    }
+
+    void Benchmark::hashingTables(const std::string &scenesFolder, int sceneId, int index, const std::vector<uint> &tableCounts,
+                                  float margin, int runs) {
+        assert(runs > 0);
+        assert(margin > 0);
+        cv::Ptr<ClassifierCriteria> criteria = classifier.criteria;
+        const float multiProbeMargin = criteria->multiProbeMargin;
+
+        Scene scene;
+        std::vector<std::vector<Window>> objectness, windows;
+        prepareScene(scenesFolder, sceneId, index, scene, objectness, false);
+
+        // Reference matches using all tables without multi-probe
+        std::vector<Match> reference;
+        criteria->multiProbeMargin = 0;
+        runHashing(scene, objectness, windows);
+        runMatching(scene, windows, reference);
+        nms(reference, criteria->overlapFactor);
+
+        std::cout << "Hashing tables benchmark..." << std::endl;
+        std::cout << "  |_ Scene " << sceneId << ", image " << index << ", tables: " << classifier.tables.size()
+                  << ", reference matches: " << reference.size() << std::endl;
+
+        // Subsets are formed from the first N tables in trained order (by size or by greedy selection)
+        std::vector<HashTable> tables;
+        tables.swap(classifier.tables);
+
+        for (auto &count : tableCounts) {
+            classifier.tables.assign(tables.begin(), tables.begin() + std::min<size_t>(count, tables.size()));
+
+            for (int probe = 0; probe < 2; ++probe) {
+                criteria->multiProbeMargin = (probe == 1) ? margin : 0;
+                double elapsed = 0;
+
+                for (int i = 0; i < runs; ++i) {
+                    elapsed += runHashing(scene, objectness, windows);
+                }
+
+                // Count candidates passed to matching
+                size_t verified = 0, candidates = 0;
+                for (auto &level : windows) {
+                    verified += level.size();
+                    for (auto &window : level) {
+                        candidates += window.candidates.size();
+                    }
+                }
+
+                std::vector<Match> matches;
+                runMatching(scene, windows, matches);
+                nms(matches, criteria->overlapFactor);
+
+                // Count reference matches found again
+                size_t found = 0;
+                for (auto &ref : reference) {
+                    for (auto &match : matches) {
+                        if (match.t->objId == ref.t->objId && ref.overlap(match) >= criteria->overlapFactor) {
+                            found++;
+                            break;
+                        }
+                    }
+                }
+
+                std::cout << "  |_ tables: " << classifier.tables.size() << ", multi-probe: " << probe << ", hashing took: "
+                          << elapsed / runs << "s, avg candidates: " << (verified > 0 ? candidates / static_cast<float>(verified) : 0)
+                          << ", matches: " << matches.size() << ", recall: "
+                          << (reference.empty() ? 1.0f : found / static_cast<float>(reference.size())) << std::endl;
+            }
+        }
+
+        // Restore tables and criteria
+        classifier.tables.swap(tables);
+        criteria->multiProbeMargin = multiProbeMargin;
+        std::cout << std::endl;
+    }
+
+    void Benchmark::normalsQuantization(const std::string &scenesFolder, int sceneId, int index, int runs) {
+        assert(runs > 0);
+        cv::Ptr<ClassifierCriteria> criteria = classifier.criteria;
+        const SimdLevel defaultLevel = simdLevel();
+
+        // Load scene
+        std::string scenePath = cv::format((scenesFolder + "%02d/").c_str(), sceneId);
+        Scene scene = classifier.parser.parseScene(scenePath, index, criteria->pyrScaleFactor, criteria->pyrLvlsDown, criteria->pyrLvlsUp);
+
+        std::cout << "Normals quantization benchmark..." << std::endl;
+        std::cout << "  |_ Scene " << sceneId << ", image " << index << ", SIMD level: " << static_cast<int>(defaultLevel) << std::endl;
+
+        for (int normals3D = 1; normals3D >= 0; --normals3D) {
+            double elapsed[2] = {0, 0};
+            bool identical = true;
+
+            for (auto &pyramid : scene.pyramid) {
+                const int maxDifference = static_cast<int>(criteria->maxDepthDiff / pyramid.scale);
+                cv::Mat normals[2], normals3DMats[2];
+
+                // Scalar version first, then the best vectorized version
+                for (int v = 0; v < 2; ++v) {
+                    setSimdLevel(v == 0 ? SimdLevel::SCALAR : defaultLevel);
+                    Timer tNormals;
+
+                    for (int i = 0; i < runs; ++i) {
+                        quantizedNormals(pyramid.srcDepth, normals[v], normals3DMats[v], pyramid.camera.fx(), pyramid.camera.fy(),
+                                         static_cast<int>(criteria->info.maxDepth), maxDifference, normals3D == 1);
+                    }
+
+                    elapsed[v] += tNormals.elapsed() / runs;
+                }
+
+                // Check that outputs are bit-identical
+                identical &= std::memcmp(normals[0].data, normals[1].data, normals[0].total()) == 0;
+                if (normals3D == 1) {
+                    identical &= std::memcmp(normals3DMats[0].data, normals3DMats[1].data, normals3DMats[0].total() * normals3DMats[0].elemSize()) == 0;
+                }
+            }
+
+            std::cout << "  |_ 3D normals: " << normals3D << ", scalar took: " << elapsed[0] << "s, vectorized took: " << elapsed[1]
+                      << "s, speedup: " << elapsed[0] / elapsed[1] << ", identical: " << identical << std::endl;
+        }
+
+        // Restore SIMD level
+        setSimdLevel(defaultLevel);
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef VSB_SEMESTRAL_PROJECT_BENCHMARK_H
+#define VSB_SEMESTRAL_PROJECT_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include "../objdetect/classifier.h"
+
+namespace tless {
+    /**
+     * @brief Measures performance of individual detection stages of trained (or loaded) classifier on a recorded scene.
+     */
+    class Benchmark {
+    private:
+        Classifier &classifier;
+
+        /**
+         * @brief Parses scene and runs objectness detection and hashing verification for each level of scene pyramid.
+         *
+         * @param[in]  scenesFolder Base path to scenes folder
+         * @param[in]  sceneId      Scene ID
+         * @param[in]  index        Index of the scene image
+         * @param[out] scene        Parsed scene
+         * @param[out] windows      Windows with candidates for each level of scene pyramid
+         * @param[in]  verify       Run hashing verification, otherwise windows are only the result of objectness detection
+         */
+        void prepareScene(const std::string &scenesFolder, int sceneId, int index, Scene &scene,
+                          std::vector<std::vector<Window>> &windows, bool verify = true);
+
+        /**
+         * @brief Runs hashing verification on all levels of scene pyramid with current tables and criteria.
+         *
+         * @param[in]  scene      Parsed scene
+         * @param[in]  objectness Windows found by objectness detection for each level of scene pyramid
+         * @param[out] windows    Windows with candidates for each level of scene pyramid
+         * @return                Time hashing took [seconds]
+         */
+        double runHashing(Scene &scene, const std::vector<std::vector<Window>> &objectness, std::vector<std::vector<Window>> &windows);
+
+        /**
+         * @brief Runs template matching on all levels of scene pyramid with current criteria.
+         *
+         * @param[in]  scene   Parsed scene
+         * @param[in]  windows Windows with candidates for each level of scene pyramid
+         * @param[out] matches Found matches (before non-maxima suppression)
+         * @return             Time matching took [seconds]
+         */
+        double runMatching(Scene &scene, std::vector<std::vector<Window>> &windows, std::vector<Match> &matches);
+
+    public:
+        explicit Benchmark(Classifier &classifier) : classifier(classifier) {}
+
+        /**
+         * @brief Compares window-major and template-major candidate evaluation order in template matching.
+         *
+         * @param[in] scenesFolder Base path to scenes folder
+         * @param[in] sceneId      Scene ID
+         * @param[in] index        Index of the scene image
+         * @param[in] runs         Number of runs of each order, average time is reported
+         */
+        void matchingOrder(const std::string &scenesFolder, int sceneId, int index, int runs = 10);
+
+        /**
+         * @brief Measures scaling of template matching stage from 1 to maxThreads threads.
+         *
+         * @param[in] scenesFolder Base path to scenes folder
+         * @param[in] sceneId      Scene ID
+         * @param[in] index        Index of the scene image
+         * @param[in] maxThreads   Max number of threads to measure (0 = omp_get_max_threads())
+         * @param[in] runs         Number of runs for each number of threads, average time is reported
+         */
+        void threadScaling(const std::string &scenesFolder, int sceneId, int index, int maxThreads = 0, int runs = 10);
+
+        /**
+         * @brief Compares hashing with subsets of trained tables, with and without multi-probe hashing.
+         *
+         * Matches found using all tables without multi-probe are used as reference, recall of each configuration is
+         * the fraction of reference matches (after NMS), that were found again (same object, overlap >= criteria.overlapFactor).
+         * Hashing cascade (criteria.firstTierTables and info.firstTierMinVotes) still applies to each subset, so with
+         * the cascade enabled subsets don't measure plain N tables voting.
+         *
+         * @param[in] scenesFolder Base path to scenes folder
+         * @param[in] sceneId      Scene ID
+         * @param[in] index        Index of the scene image
+         * @param[in] tableCounts  Numbers of tables to use (first N tables in trained order)
+         * @param[in] margin       Multi-probe margin used in probing configurations (criteria.multiProbeMargin)
+         * @param[in] runs         Number of hashing runs of each configuration, average time is reported
+         */
+        void hashingTables(const std::string &scenesFolder, int sceneId, int index, const std::vector<uint> &tableCounts,
+                           float margin = 0.1f, int runs = 10);
+
+        /**
+         * @brief Compares scalar and vectorized surface normal quantization on all levels of scene pyramid.
+         *
+         * Each version runs with and without 3D normals, outputs of vectorized versions are checked to be identical
+         * with scalar ones.
+         *
+         * @param[in] scenesFolder Base path to scenes folder
+         * @param[in] sceneId      Scene ID
+         * @param[in] index        Index of the scene image
+         * @param[in] runs         Number of runs of each version, average time is reported
+         */
+        void normalsQuantization(const std::string &scenesFolder, int sceneId, int index, int runs = 10);
+    };
+}
+
+#endif
@@ -9,6 +9,10 @@
 namespace tless {
     int Parser::idCounter = 0;
 
+    void Parser::reserveIds(int lastId) {
+        idCounter = std::max(idCounter, lastId);
+    }
+
     void Parser::parseObject(const std::string &basePath, std::vector<Template> &templates) {
         // Load object info.yml.gz at the root of each object folder
         cv::FileStorage fsInfo(basePath + "info.yml.gz", cv::FileStorage::READ);
@@ -47,12 +51,9 @@ namespace tless {
         assert(srcRGB.type() == CV_8UC3);
         assert(srcDepth.type() == CV_16U);
 
-        cv::Mat srcHSV, srcHue, srcGray;
-        cv::cvtColor(srcRGB, srcHSV, CV_BGR2HSV);
-        cv::cvtColor(srcRGB, srcGray, CV_BGR2GRAY);
-
-        // Normalize HSV
-        normalizeHSV(srcHSV, srcHue);
+        // Convert to gray and normalized hue
+        cv::Mat srcHue, srcGray;
+        grayHue(srcRGB, srcGray, srcHue);
 
         // Generate quantized orientations
         cv::Mat gradients;
@@ -72,7 +73,11 @@ namespace tless {
         parseCriteriaAndNormals(t);
     }
 
-    void Parser::parseCriteriaAndNormals(Template &t) {
+    int Parser::objMinEdgels() const {
+        return objEdgels.empty() ? 0 : objEdgels[0];
+    }
+
+    void Parser::parseInfo(const Template &t) {
         // Parse largest area and smallest areas
         if (t.objBB.area() < criteria->info.smallestTemplate.area()) { criteria->info.smallestTemplate = t.objBB.size(); }
         if (t.objBB.width > criteria->info.largestArea.width) { criteria->info.largestArea.width = t.objBB.width; }
@@ -84,6 +89,10 @@ namespace tless {
 
         // Extract smallest diameter
         if (t.diameter < criteria->info.smallestDiameter) { criteria->info.smallestDiameter = t.diameter; }
+    }
+
+    void Parser::parseCriteriaAndNormals(Template &t) {
+        parseInfo(t);
 
         // Extract min edgels
         cv::Mat integral, edgels;
@@ -102,7 +111,7 @@ namespace tless {
 
         // Compute normals
         cv::Mat normals3D;
-        quantizedNormals(t.srcDepth, t.srcNormals, normals3D, t.camera.fx(), t.camera.fy(), t.maxDepth, static_cast<int>(criteria->maxDepthDiff / t.resizeRatio));
+        quantizedNormals(t.srcDepth, t.srcNormals, normals3D, t.camera.fx(), t.camera.fy(), t.maxDepth, static_cast<int>(criteria->maxDepthDiff / t.resizeRatio), false);
     }
 
     Scene Parser::parseScene(const std::string &basePath, int index, float scaleFactor, int levelsUp, int levelsDown) {
@@ -136,11 +145,9 @@ namespace tless {
         cv::Mat t = cv::Mat(3, 1, CV_32FC1, vCamTw2c.data());
         fs.release();
 
-        // Create gray and hsv images
-        cv::Mat srcHSV, srcHue, srcGray;
-        cv::cvtColor(srcRGB, srcGray, CV_BGR2GRAY);
-        cv::cvtColor(srcRGB, srcHSV, CV_BGR2HSV);
-        normalizeHSV(srcHSV, srcHue);
+        // Create gray and normalized hue images
+        cv::Mat srcHue, srcGray;
+        grayHue(srcRGB, srcGray, srcHue);
 
         // Reserve size for scene pyramid
         const int pyrSize = levelsDown + levelsUp + 1;
@@ -205,6 +212,14 @@ namespace tless {
         // Spread features
         spread(pyramid.srcNormals, pyramid.spreadNormals, criteria->patchOffset * 2 + 1);
         spread(pyramid.srcGradients, pyramid.spreadGradients, criteria->patchOffset * 2 + 1);
+        spreadDepth(pyramid.srcDepth, pyramid.spreadMinDepth, pyramid.spreadMaxDepth, criteria->patchOffset * 2 + 1);
+        spreadHue(pyramid.srcHue, pyramid.spreadHue, criteria->patchOffset * 2 + 1);
+
+        // Linearize response maps of spread features for linearized matching
+        if (criteria->linearMatching) {
+            responseMaps(pyramid.spreadNormals, pyramid.linearNormals, 8, criteria->windowStep);
+            responseMaps(pyramid.spreadGradients, pyramid.linearGradients, 5, criteria->windowStep);
+        }
 
         return pyramid;
     }
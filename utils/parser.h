@@ -50,6 +50,27 @@ namespace tless {
     public:
         Parser(cv::Ptr<ClassifierCriteria> criteria) : criteria(criteria) {};
 
+        /**
+         * @brief Makes sure newly parsed templates get ids larger than given id (e.g. when adding objects to loaded classifier).
+         *
+         * @param[in] lastId Largest template id already in use
+         */
+        static void reserveIds(int lastId);
+
+        /**
+         * @brief Updates criteria info (template sizes, depth extremes and smallest diameter) with given template.
+         *
+         * @param[in] t Template to update criteria info with
+         */
+        void parseInfo(const Template &t);
+
+        /**
+         * @brief Returns minimum number of edgels (outliers removed) found in templates of the last parsed object.
+         *
+         * @return Minimum number of edgels, 0 if no object was parsed yet
+         */
+        int objMinEdgels() const;
+
         /**
          * @brief Parses templates for one object in given path.
          *
@@ -45,7 +45,7 @@ namespace tless {
     }
 
 #ifdef VIZ_HASHING
-    void Visualizer::windowCandidates(const cv::Mat &src, cv::Mat &dst, Window &window) {
+    void Visualizer::windowCandidates(const cv::Mat &src, cv::Mat &dst, const FeatureStore &store, Window &window) {
         std::ostringstream oss;
         dst = src.clone();
 
@@ -53,13 +53,13 @@ namespace tless {
         if (!window.candidates.empty()) {
             // Define grid, offsets and initialize tpl mosaic matrix
             const int offset = 8, topOffset = 25;
-            int x, y, width = window.candidates[0]->objBB.width;
+            int x, y, width = store[window.candidates[0]].width;
             int sizeX = width + 2 * offset, sizeY = width + offset + topOffset;
             auto gridSize = static_cast<int>(std::ceil(std::sqrt(window.candidates.size())));
             cv::Mat tplMosaic = cv::Mat::zeros(gridSize * sizeY, gridSize * sizeX, CV_8UC3);
 
             for (int i = 0; i < window.candidates.size(); ++i) {
-                Template *candidate = window.candidates[i];
+                Template *candidate = store.tpl(window.candidates[i]);
 
                 // Calculate x, y and rect inside defined mosaic grid
                 x = (i % gridSize);
@@ -102,7 +102,7 @@ namespace tless {
         }
     }
 
-    void Visualizer::windowsCandidates(const ScenePyramid &scene, std::vector<Window> &windows, int wait,
+    void Visualizer::windowsCandidates(const ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, int wait,
                                        const char *title) {
         const auto winSize = static_cast<const int>(windows.size());
         std::ostringstream oss;
@@ -119,7 +119,7 @@ namespace tless {
             }
 
             // Vizualize window candidates
-            windowCandidates(result, result, windows[i]);
+            windowCandidates(result, result, store, windows[i]);
 
             // Title
             if (settings[SETTINGS_TITLE]) {
@@ -367,10 +367,10 @@ namespace tless {
         cv::Point offsetStart(-patchOffset, -patchOffset), offsetEnd(patchOffset, patchOffset);
 
         // Dynamically load template images
-        cv::Mat gray;
+        cv::Mat gray, hue;
         cv::Mat rgb = loadTemplateSrc(t, CV_LOAD_IMAGE_COLOR);
         cv::Mat depth = loadTemplateSrc(t, CV_LOAD_IMAGE_UNCHANGED);
-        cv::cvtColor(rgb, gray, CV_BGR2GRAY);
+        grayHue(rgb, gray, hue);
 
         // Load orientation gradients
         cv::Mat gradients;
@@ -380,11 +380,6 @@ namespace tless {
         cv::Mat normals, normals3D;
         quantizedNormals(depth, normals, normals3D, t.camera.fx(), t.camera.fy(), t.maxDepth, static_cast<int>(criteria->maxDepthDiff / t.resizeRatio));
 
-        // Load hue
-        cv::Mat hue, hsv;
-        cv::cvtColor(rgb, hsv, CV_BGR2HSV);
-        normalizeHSV(hsv, hue);
-
         // Multiply normals and gradients to be better visible
         gradients *= 16;
         normals *= 2;
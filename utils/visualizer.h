@@ -8,6 +8,7 @@
 #include "../core/template.h"
 #include "../core/classifier_criteria.h"
 #include "../core/hash_table.h"
+#include "../core/feature_store.h"
 #include "../core/match.h"
 #include "../core/scene.h"
 #include "../glcore/mesh.h"
@@ -40,10 +41,11 @@ namespace tless {
          *
          * @param[in]  src    8-bit rgb image of the scene we want to vizualize hashing on
          * @param[out] dst    Destination image annotated with current window
+         * @param[in]  store  Feature store used to resolve template handles of window candidates
          * @param[in]  window Sliding window that passed hashing verification
          */
 #ifdef VIZ_HASHING
-        void windowCandidates(const cv::Mat &src, cv::Mat &dst, Window &window);
+        void windowCandidates(const cv::Mat &src, cv::Mat &dst, const FeatureStore &store, Window &window);
 #endif
 
     public:
@@ -74,15 +76,16 @@ namespace tless {
          * @brief Vizualizes candidates for given window array along with matched triplets and number of votes.
          *
          * @param[in] scene   Scene object we want to vizualize hashing on
+         * @param[in] store   Feature store used to resolve template handles of window candidates
          * @param[in] windows Array of sliding windows that passed hashing verification and contain candidates
          * @param[in] wait    Optional wait time in waitKey() function
          * @param[in] title   Optional image window title
          */
 #ifdef VIZ_HASHING
-        void windowsCandidates(const ScenePyramid &scene, std::vector<Window> &windows, int wait = 0,
+        void windowsCandidates(const ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, int wait = 0,
                                const char *title = nullptr);
 #else
-        void windowsCandidates(const ScenePyramid &scene, std::vector<Window> &windows, int wait = 0,
+        void windowsCandidates(const ScenePyramid &scene, const FeatureStore &store, std::vector<Window> &windows, int wait = 0,
                                const char *title = nullptr) { void(); }
 #endif
 